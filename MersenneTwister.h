@@ -66,11 +66,17 @@
 #include <cstdio>
 #include <ctime>
 #include <cmath>
+#include <cstddef>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 class MTRand {
 // Data
 public:
-	typedef unsigned long uint32;  // unsigned integer type, at least 32 bits
+	// exactly 32 bits, so the state can be worked on four words at a time;
+	// the numbers are the same as with any wider type
+	typedef unsigned int uint32;
 	
 	enum { N = 624 };       // length of state vector
 	enum { SAVE = N + 1 };  // length of array for save()
@@ -110,6 +116,15 @@ public:
 	// Access to nonuniform random number distributions
 	double randNorm( const double mean = 0.0, const double stddev = 1.0 );
 	
+	// Bulk access to many numbers at once.  Each gives the same numbers as
+	// count calls of the single function, and leaves the generator in the
+	// same state, so seeds reproduce the same sequences either way.  The
+	// state reload and tempering work on four words at a time with SSE2.
+	void fillInt( uint32 *array, size_t count );   // as randInt()
+	void fill( double *array, size_t count );      // as rand()
+	void fillExc( double *array, size_t count );   // as randExc()
+	void fillExc( float *array, size_t count );    // real number in [0,1)
+	
 	// Re-seeding functions with same behavior as initializers
 	void seed( const uint32 oneSeed );
 	void seed( uint32 *const bigSeed, const uint32 seedLength = N );
@@ -134,6 +149,10 @@ protected:
 		{ return loBit(u) ? 0x9908b0dfUL : 0x0UL; }
 	uint32 twist( const uint32 m, const uint32 s0, const uint32 s1 ) const
 		{ return m ^ (mixBits(s0,s1)>>1) ^ magic(s1); }
+	static void temper( const uint32 *in, uint32 *out, size_t count );
+#ifdef __SSE2__
+	static __m128i twist4( __m128i m, __m128i s0, __m128i s1 );
+#endif
 	static uint32 hash( time_t t, clock_t c );
 };
 
@@ -181,6 +200,20 @@ inline void MTRand::initialize( const uint32 seed )
 	}
 }
 
+#ifdef __SSE2__
+inline __m128i MTRand::twist4( __m128i m, __m128i s0, __m128i s1 )
+{
+	// twist() on four words; magic() is the low bit of s1 spread over
+	// the word (0 - bit) and masked with the constant
+	__m128i mixed = _mm_or_si128( _mm_and_si128( s0, _mm_set1_epi32(0x80000000) ),
+	                              _mm_and_si128( s1, _mm_set1_epi32(0x7fffffff) ) );
+	__m128i lowBit = _mm_and_si128( s1, _mm_set1_epi32(1) );
+	__m128i magic = _mm_and_si128( _mm_sub_epi32( _mm_setzero_si128(), lowBit ),
+	                               _mm_set1_epi32(0x9908b0df) );
+	return _mm_xor_si128( _mm_xor_si128( m, _mm_srli_epi32( mixed, 1 ) ), magic );
+}
+#endif
+
 inline void MTRand::reload()
 {
 	// Generate N new values in state
@@ -188,10 +221,34 @@ inline void MTRand::reload()
 	static const int MmN = int(M) - int(N);  // in case enums are unsigned
 	register uint32 *p = state;
 	register int i;
+#ifdef __SSE2__
+	// Four at a time where the words read are at least four behind or
+	// ahead of the ones written (N-M and M are both more than 4); each
+	// loop ends with the leftover words one by one
+	for( i = N - M; i >= 4; i -= 4, p += 4 )
+	{
+		__m128i m = _mm_loadu_si128( (const __m128i*)(p + M) );
+		__m128i s0 = _mm_loadu_si128( (const __m128i*)p );
+		__m128i s1 = _mm_loadu_si128( (const __m128i*)(p + 1) );
+		_mm_storeu_si128( (__m128i*)p, twist4( m, s0, s1 ) );
+	}
+	for( ; i--; ++p )
+		*p = twist( p[M], p[0], p[1] );
+	for( i = M - 1; i >= 4; i -= 4, p += 4 )
+	{
+		__m128i m = _mm_loadu_si128( (const __m128i*)(p + MmN) );
+		__m128i s0 = _mm_loadu_si128( (const __m128i*)p );
+		__m128i s1 = _mm_loadu_si128( (const __m128i*)(p + 1) );
+		_mm_storeu_si128( (__m128i*)p, twist4( m, s0, s1 ) );
+	}
+	for( ++i; --i; ++p )
+		*p = twist( p[MmN], p[0], p[1] );
+#else
 	for( i = N - M; i--; ++p )
 		*p = twist( p[M], p[0], p[1] );
 	for( i = M; --i; ++p )
 		*p = twist( p[MmN], p[0], p[1] );
+#endif
 	*p = twist( p[MmN], p[0], state[0] );
 	
 	left = N, pNext = state;
@@ -302,6 +359,91 @@ inline MTRand::uint32 MTRand::randInt()
 	return ( s1 ^ (s1 >> 18) );
 }
 
+inline void MTRand::temper( const uint32 *in, uint32 *out, size_t count )
+{
+	// The output function of randInt(), on count state words at once
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i b = _mm_set1_epi32(0x9d2c5680);
+	const __m128i c = _mm_set1_epi32(0xefc60000);
+	for( ; i + 4 <= count; i += 4 )
+	{
+		__m128i s1 = _mm_loadu_si128( (const __m128i*)(in + i) );
+		s1 = _mm_xor_si128( s1, _mm_srli_epi32( s1, 11 ) );
+		s1 = _mm_xor_si128( s1, _mm_and_si128( _mm_slli_epi32( s1, 7 ), b ) );
+		s1 = _mm_xor_si128( s1, _mm_and_si128( _mm_slli_epi32( s1, 15 ), c ) );
+		s1 = _mm_xor_si128( s1, _mm_srli_epi32( s1, 18 ) );
+		_mm_storeu_si128( (__m128i*)(out + i), s1 );
+	}
+#endif
+	for( ; i < count; ++i )
+	{
+		uint32 s1 = in[i];
+		s1 ^= (s1 >> 11);
+		s1 ^= (s1 <<  7) & 0x9d2c5680UL;
+		s1 ^= (s1 << 15) & 0xefc60000UL;
+		out[i] = ( s1 ^ (s1 >> 18) );
+	}
+}
+
+inline void MTRand::fillInt( uint32 *array, size_t count )
+{
+	// Take what is left of the state, reloading it as randInt() would
+	while( count > 0 )
+	{
+		if( left == 0 ) reload();
+		size_t n = ( count < size_t(left) ? count : size_t(left) );
+		temper( pNext, array, n );
+		pNext += n;
+		left -= int(n);
+		array += n;
+		count -= n;
+	}
+}
+
+inline void MTRand::fill( double *array, size_t count )
+{
+	uint32 buffer[256];
+	while( count > 0 )
+	{
+		size_t n = ( count < 256 ? count : 256 );
+		fillInt( buffer, n );
+		for( size_t i = 0; i < n; ++i )
+			array[i] = double(buffer[i]) * (1.0/4294967295.0);
+		array += n;
+		count -= n;
+	}
+}
+
+inline void MTRand::fillExc( double *array, size_t count )
+{
+	uint32 buffer[256];
+	while( count > 0 )
+	{
+		size_t n = ( count < 256 ? count : 256 );
+		fillInt( buffer, n );
+		for( size_t i = 0; i < n; ++i )
+			array[i] = double(buffer[i]) * (1.0/4294967296.0);
+		array += n;
+		count -= n;
+	}
+}
+
+inline void MTRand::fillExc( float *array, size_t count )
+{
+	// The top 24 bits, all a float holds, so none rounds up to 1
+	uint32 buffer[256];
+	while( count > 0 )
+	{
+		size_t n = ( count < 256 ? count : 256 );
+		fillInt( buffer, n );
+		for( size_t i = 0; i < n; ++i )
+			array[i] = float(buffer[i] >> 8) * (1.0f/16777216.0f);
+		array += n;
+		count -= n;
+	}
+}
+
 inline MTRand::uint32 MTRand::randInt( const uint32 n )
 {
 	// Find which bits are used in n
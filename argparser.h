@@ -2,7 +2,9 @@
 #define __ARG_PARSER_H__
 
 #include <string>
+#include <vector>
 #include <cassert>
+#include <ctime>
 #include "MersenneTwister.h"
 
 // ====================================================================================
@@ -18,7 +20,7 @@ public:
     for (int i = 1; i < argc; i++) {
       if (argv[i] == std::string("-input")) {
         i++; assert (i < argc); 
-        input_file = argv[i];
+        input_files.push_back(argv[i]);
       } else if (argv[i] == std::string("-size")) {
         i++; assert (i < argc); 
         width = height = atoi(argv[i]);
@@ -27,6 +29,78 @@ public:
       } else if (argv[i] == std::string("-trees")) {
         i++; assert (i < argc); 
         trees = atoi(argv[i]);
+      } else if (argv[i] == std::string("-lazy_views")) {
+        lazy_views = true;
+      } else if (argv[i] == std::string("-mesh_distance")) {
+        i++; assert (i < argc); 
+        mesh_distance = atof(argv[i]);
+      } else if (argv[i] == std::string("-mesh_budget")) {
+        i++; assert (i < argc); 
+        mesh_budget = atoi(argv[i]);
+      } else if (argv[i] == std::string("-cluster_distance")) {
+        i++; assert (i < argc); 
+        cluster_distance = atof(argv[i]);
+      } else if (argv[i] == std::string("-no_occlusion_culling")) {
+        occlusion_culling = false;
+      } else if (argv[i] == std::string("-alpha_mode")) {
+        i++; assert (i < argc); 
+        alpha_mode = argv[i];
+        assert (alpha_mode == "blend" || alpha_mode == "coverage" || alpha_mode == "alphatest");
+      } else if (argv[i] == std::string("-distribution")) {
+        i++; assert (i < argc); 
+        distribution = argv[i];
+        assert (distribution == "poisson" || distribution == "lattice");
+      } else if (argv[i] == std::string("-water_level")) {
+        i++; assert (i < argc); 
+        water_level = atof(argv[i]);
+      } else if (argv[i] == std::string("-tree_line")) {
+        i++; assert (i < argc); 
+        tree_line = atof(argv[i]);
+      } else if (argv[i] == std::string("-max_slope")) {
+        i++; assert (i < argc); 
+        max_slope = atof(argv[i]);
+      } else if (argv[i] == std::string("-no_ecology")) {
+        ecology = false;
+      } else if (argv[i] == std::string("-seed")) {
+        i++; assert (i < argc); 
+        seed = strtoul(argv[i], NULL, 10);
+      } else if (argv[i] == std::string("-save_world")) {
+        i++; assert (i < argc); 
+        save_world = argv[i];
+      } else if (argv[i] == std::string("-load_world")) {
+        i++; assert (i < argc); 
+        load_world = argv[i];
+      } else if (argv[i] == std::string("-tree_spacing")) {
+        i++; assert (i < argc); 
+        tree_spacing = atof(argv[i]);
+        assert (tree_spacing > 0);
+      } else if (argv[i] == std::string("-threads")) {
+        i++; assert (i < argc); 
+        threads = atoi(argv[i]);
+        assert (threads >= 0);
+      } else if (argv[i] == std::string("-atlas_budget")) {
+        i++; assert (i < argc); 
+        atlas_budget = atof(argv[i]);
+        assert (atlas_budget > 0);
+      } else if (argv[i] == std::string("-target_frame_ms")) {
+        i++; assert (i < argc); 
+        target_frame_ms = atof(argv[i]);
+        assert (target_frame_ms >= 0);
+      } else if (argv[i] == std::string("-headless")) {
+        headless = true;
+      } else if (argv[i] == std::string("-camera_path")) {
+        i++; assert (i < argc); 
+        camera_path = argv[i];
+      } else if (argv[i] == std::string("-frames")) {
+        i++; assert (i < argc); 
+        frames = atoi(argv[i]);
+        assert (frames >= 0);
+      } else if (argv[i] == std::string("-dump_frames")) {
+        i++; assert (i < argc); 
+        dump_frames = argv[i];
+      } else if (argv[i] == std::string("-timings")) {
+        i++; assert (i < argc); 
+        timings = argv[i];
       } else {
         printf ("whoops error with command line argument %d: '%s'\n",i,argv[i]);
         assert(0);
@@ -39,16 +113,80 @@ public:
     height = 500;
     gouraud = false;
     trees = 10;
+    lazy_views = false;
+    mesh_distance = 30;
+    mesh_budget = 32;
+    cluster_distance = 120;
+    alpha_mode = "blend";
+    occlusion_culling = true;
+    distribution = "poisson";
+    tree_spacing = 3.5;
+    ecology = true;
+    water_level = -2;
+    tree_line = 4;
+    max_slope = 40;
+    seed = (unsigned int)time(0);
+    save_world = "world.snap";
+    threads = 0;
+    atlas_budget = 32;
+    target_frame_ms = 0;
+    headless = false;
+    camera_path = "camera.path";
+    frames = 0;
   }
 
   // ==============
   // REPRESENTATION
   // all public! (no accessors)
-  std::string input_file;
+  // the tree species, one .obj each (-input can be given more than once)
+  std::vector<std::string> input_files;
   int width;
   int height;
   bool gouraud;
   int trees;
+  bool lazy_views;
+  float mesh_distance;
+  int mesh_budget;
+  float cluster_distance;
+  // how the edges of the tree impostors are drawn: blend (sorted back
+  // to front), coverage (alpha to coverage on a multisampled window) or
+  // alphatest (a hard cutoff); the last two draw in any order
+  std::string alpha_mode;
+  bool occlusion_culling;
+  // where the trees go: poisson (no two closer than tree_spacing) or
+  // lattice (the old jittered rows in every block)
+  std::string distribution;
+  float tree_spacing;
+  // where on the terrain trees grow (see EcologyRules): above the
+  // water, below the tree line, and on slopes up to max_slope degrees
+  bool ecology;
+  float water_level;
+  float tree_line;
+  float max_slope;
+  // the seed of GLOBAL_rng, for the same world on every run
+  unsigned int seed;
+  // the world snapshot written with the 'o' key, and one to start from
+  // instead of generating a new world
+  std::string save_world;
+  std::string load_world;
+  // threads in the job system, counting the main thread (0 for one
+  // per core)
+  int threads;
+  // megabytes of GPU memory for the views of all the species together
+  float atlas_budget;
+  // the frame time to keep the quality down to, e.g. 16.6 (0 for always
+  // the full quality, see QualityController)
+  float target_frame_ms;
+  // render the cameras of camera_path offscreen, without a window, and
+  // exit (the 'p' key adds the current camera to the path).  frames is
+  // how many to render, going round the path again if it is shorter
+  // (0 for the path once); each can be written to dump_frames0000.ppm
+  // and on, and the time of each to the timings file as CSV.
+  bool headless;
+  std::string camera_path;
+  int frames;
+  std::string dump_frames;
+  std::string timings;
   MTRand mtrand;
 
 };
@@ -3,7 +3,7 @@
 #include <cassert>
 #include <string>
 #include "camera.h"
-#include "matrix.h"
+#include "simdmath.h"
 
 // ====================================================================
 // ====================================================================
@@ -128,13 +128,13 @@ void Camera::rotateCamera(double rx, double ry) {
     ry = tiltAngle - 3.13;
   else if (tiltAngle-ry < 0.01)
     ry = tiltAngle - 0.01;
-  Matrix rotMat;
-  rotMat.setToIdentity();
-  rotMat *= Matrix::MakeTranslation(point_of_interest);
-  rotMat *= Matrix::MakeAxisRotation(up, rx);
-  rotMat *= Matrix::MakeAxisRotation(getHorizontal(), ry);
-  rotMat *= Matrix::MakeTranslation(-point_of_interest);
-  rotMat.Transform(camera_position);
+  // single precision is plenty for a mouse drag
+  Mat4s rotMat;
+  rotMat *= Mat4s::MakeTranslation(point_of_interest);
+  rotMat *= Mat4s::MakeAxisRotation(up, rx);
+  rotMat *= Mat4s::MakeAxisRotation(getHorizontal(), ry);
+  rotMat *= Mat4s::MakeTranslation(-point_of_interest);
+  camera_position = rotMat.Transform(camera_position);
 }
 
 // ====================================================================
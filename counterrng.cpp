@@ -0,0 +1,149 @@
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "counterrng.h"
+
+// the Philox4x32 multipliers and key increments (Weyl sequence)
+static const CounterRNG::uint32 PHILOX_M0 = 0xD2511F53;
+static const CounterRNG::uint32 PHILOX_M1 = 0xCD9E8D57;
+static const CounterRNG::uint32 PHILOX_W0 = 0x9E3779B9;
+static const CounterRNG::uint32 PHILOX_W1 = 0xBB67AE85;
+static const int PHILOX_ROUNDS = 10;
+
+// =======================================================================
+// ONE COUNTER
+// =======================================================================
+
+void CounterRNG::block(uint32 stream, uint32 sub, uint64 counter, uint32 out[4]) const {
+  uint32 x0 = (uint32)counter, x1 = (uint32)(counter >> 32), x2 = sub, x3 = 0;
+  uint32 k0 = key, k1 = stream;
+  for (int r = 0; r < PHILOX_ROUNDS; r++) {
+    uint64 p0 = (uint64)PHILOX_M0 * x0;
+    uint64 p1 = (uint64)PHILOX_M1 * x2;
+    uint32 y0 = (uint32)(p1 >> 32) ^ x1 ^ k0;
+    uint32 y2 = (uint32)(p0 >> 32) ^ x3 ^ k1;
+    x1 = (uint32)p1;
+    x3 = (uint32)p0;
+    x0 = y0;
+    x2 = y2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+}
+
+// =======================================================================
+// FOUR COUNTERS AT ONCE
+// =======================================================================
+
+#ifdef __SSE2__
+
+// the high and low halves of the 32x32 bit products of every lane
+static inline void mulhilo(__m128i m, __m128i x, __m128i &hi, __m128i &lo) {
+  // _mm_mul_epu32 only multiplies lanes 0 and 2, so lanes 1 and 3 are
+  // shifted down for a second multiply
+  __m128i even = _mm_mul_epu32(x, m);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), m);
+  __m128i low_lanes = _mm_set_epi32(0, -1, 0, -1);
+  lo = _mm_or_si128(_mm_and_si128(even, low_lanes), _mm_slli_epi64(odd, 32));
+  hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low_lanes, odd));
+}
+
+// counters counter..counter+3, the numbers written out as by block()
+static void block4(CounterRNG::uint32 key, CounterRNG::uint32 stream, CounterRNG::uint32 sub,
+                   CounterRNG::uint64 counter, CounterRNG::uint32 *out) {
+  typedef CounterRNG::uint32 uint32;
+  // one counter per lane, a word of all four in each register
+  uint32 lo[4], hi[4];
+  for (int l = 0; l < 4; l++) {
+    lo[l] = (uint32)(counter + l);
+    hi[l] = (uint32)((counter + l) >> 32);
+  }
+  __m128i x0 = _mm_set_epi32(lo[3], lo[2], lo[1], lo[0]);
+  __m128i x1 = _mm_set_epi32(hi[3], hi[2], hi[1], hi[0]);
+  __m128i x2 = _mm_set1_epi32(sub);
+  __m128i x3 = _mm_setzero_si128();
+  __m128i m0 = _mm_set1_epi32(PHILOX_M0);
+  __m128i m1 = _mm_set1_epi32(PHILOX_M1);
+  uint32 k0 = key, k1 = stream;
+  for (int r = 0; r < PHILOX_ROUNDS; r++) {
+    __m128i hi0, lo0, hi1, lo1;
+    mulhilo(m0, x0, hi0, lo0);
+    mulhilo(m1, x2, hi1, lo1);
+    x0 = _mm_xor_si128(_mm_xor_si128(hi1, x1), _mm_set1_epi32(k0));
+    x2 = _mm_xor_si128(_mm_xor_si128(hi0, x3), _mm_set1_epi32(k1));
+    x1 = lo1;
+    x3 = lo0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  // back to one counter per register
+  __m128i t0 = _mm_unpacklo_epi32(x0, x1);
+  __m128i t1 = _mm_unpacklo_epi32(x2, x3);
+  __m128i t2 = _mm_unpackhi_epi32(x0, x1);
+  __m128i t3 = _mm_unpackhi_epi32(x2, x3);
+  _mm_storeu_si128((__m128i*)(out + 0), _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi64(t2, t3));
+}
+
+#endif
+
+// =======================================================================
+// BULK FILLS
+// =======================================================================
+
+void CounterRNG::fill(uint32 stream, uint32 sub, uint64 first, uint32 *out, size_t count) const {
+  uint32 numbers[4];
+  // the end of a partly used counter at the start
+  while (count > 0 && (first & 3) != 0) {
+    block(stream, sub, first >> 2, numbers);
+    *out++ = numbers[first++ & 3];
+    count--;
+  }
+#ifdef __SSE2__
+  for (; count >= 16; count -= 16, first += 16, out += 16) {
+    block4(key, stream, sub, first >> 2, out);
+  }
+#endif
+  for (; count >= 4; count -= 4, first += 4, out += 4) {
+    block(stream, sub, first >> 2, out);
+  }
+  if (count > 0) {
+    block(stream, sub, first >> 2, numbers);
+    std::copy(numbers, numbers + count, out);
+  }
+}
+
+// the reals are made a piece at a time through a small buffer of ints
+static const int FILL_PIECE = 256;
+
+void CounterRNG::fillExc(uint32 stream, uint32 sub, uint64 first, float *out, size_t count) const {
+  uint32 numbers[FILL_PIECE];
+  while (count > 0) {
+    size_t n = std::min(count, (size_t)FILL_PIECE);
+    fill(stream, sub, first, numbers, n);
+    // 24 bits, all a float holds, so nothing rounds up to 1
+    for (size_t i = 0; i < n; i++) out[i] = (numbers[i] >> 8) * (1.0f / 16777216.0f);
+    out += n;
+    first += n;
+    count -= n;
+  }
+}
+
+void CounterRNG::fillExc(uint32 stream, uint32 sub, uint64 first, double *out, size_t count) const {
+  uint32 numbers[FILL_PIECE];
+  while (count > 0) {
+    size_t n = std::min(count, (size_t)FILL_PIECE);
+    fill(stream, sub, first, numbers, n);
+    for (size_t i = 0; i < n; i++) out[i] = numbers[i] * (1.0 / 4294967296.0);
+    out += n;
+    first += n;
+    count -= n;
+  }
+}
+
+// =======================================================================
@@ -0,0 +1,143 @@
+#ifndef _COUNTER_RNG_H_
+#define _COUNTER_RNG_H_
+
+#include <cstddef>
+
+// ===================================================================
+// A counter-based random number generator (Philox4x32-10, from
+// Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+//
+// There is no state to advance: the index-th number of a stream is a
+// fixed function of (seed, stream, sub, index), ten rounds of
+// multiplies and xors on the counter.  Any thread can draw any number
+// in any order and get the same value, so work that draws its numbers
+// by index comes out bit for bit the same however it is split up.
+//
+// stream says what the numbers are for (one of the RandomStreamId
+// values below) and sub which one of those, e.g. the tile or the
+// terrain pass, so that no two uses ever share numbers.
+
+class CounterRNG {
+
+public:
+
+  typedef unsigned int uint32;
+  typedef unsigned long long uint64;
+
+  // ========================
+  // CONSTRUCTOR
+  CounterRNG(uint32 s = 0) : key(s) {}
+  void seed(uint32 s) { key = s; }
+  uint32 getSeed() const { return key; }
+
+  // ==================
+  // SINGLE NUMBERS
+  // the index-th 32 bit number of a stream
+  uint32 randInt(uint32 stream, uint32 sub, uint64 index) const {
+    uint32 out[4];
+    block(stream, sub, index >> 2, out);
+    return out[index & 3];
+  }
+  // real numbers in [0,1] and [0,1)
+  double rand(uint32 stream, uint32 sub, uint64 index) const {
+    return randInt(stream, sub, index) * (1.0 / 4294967295.0);
+  }
+  double randExc(uint32 stream, uint32 sub, uint64 index) const {
+    return randInt(stream, sub, index) * (1.0 / 4294967296.0);
+  }
+
+  // =============
+  // BULK FILLS
+  // count numbers of a stream starting at index first; with SSE2, four
+  // counters are worked on at once
+  void fill(uint32 stream, uint32 sub, uint64 first, uint32 *out, size_t count) const;
+  // the same numbers as reals in [0,1)
+  void fillExc(uint32 stream, uint32 sub, uint64 first, float *out, size_t count) const;
+  void fillExc(uint32 stream, uint32 sub, uint64 first, double *out, size_t count) const;
+
+  // the four numbers at one counter value, numbers 4*counter to
+  // 4*counter+3 of the stream
+  void block(uint32 stream, uint32 sub, uint64 counter, uint32 out[4]) const;
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  uint32 key;
+};
+
+// ===================================================================
+// The streams of GLOBAL_rng, and what their sub and index are
+
+enum RandomStreamId {
+  RNG_TERRAIN = 1,     // sub: diamond-square step, index: offset * 2
+  RNG_TREE_COUNTS,     // sub: 0, index: block
+  RNG_TREE_LATTICE,    // sub: block, index: tree * 2
+  RNG_TREE_POISSON,    // sub: tile, drawn in order (RandomStream)
+  RNG_SAMPLING,        // sub: caller's choice, e.g. RandomUnitVector
+  RNG_TREE_SPECIES,    // sub: block, index: tree
+  RNG_TREE_THINNING    // sub: block, index: tree
+};
+
+// ===================================================================
+// Numbers drawn one after the other from a single stream, for code
+// that uses them like an MTRand.  It is a cursor into the stream, so
+// two RandomStreams on the same stream and sub give the same numbers.
+
+class RandomStream {
+
+public:
+
+  typedef CounterRNG::uint32 uint32;
+  typedef CounterRNG::uint64 uint64;
+
+  RandomStream(const CounterRNG &r, uint32 stream_, uint32 sub_, uint64 first = 0) :
+    rng(r), stream(stream_), sub(sub_), next(first), filled(false) {}
+
+  // the next 32 bit number
+  uint32 randInt() {
+    // a new counter every four numbers
+    if (!filled || (next & 3) == 0) {
+      rng.block(stream, sub, next >> 2, buffer);
+      filled = true;
+    }
+    return buffer[next++ & 3];
+  }
+  // an integer in [0,n], as MTRand::randInt(n)
+  uint32 randInt(uint32 n) {
+    // the smallest all-ones mask that covers n, then reject the rest
+    uint32 used = n;
+    used |= used >> 1;
+    used |= used >> 2;
+    used |= used >> 4;
+    used |= used >> 8;
+    used |= used >> 16;
+    uint32 i;
+    do {
+      i = randInt() & used;
+    } while (i > n);
+    return i;
+  }
+  // real numbers in [0,1] and [0,1)
+  double rand() { return randInt() * (1.0 / 4294967295.0); }
+  double randExc() { return randInt() * (1.0 / 4294967296.0); }
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  CounterRNG rng;
+  uint32 stream;
+  uint32 sub;
+  uint64 next;
+  // the numbers of the counter next is in, once filled
+  uint32 buffer[4];
+  bool filled;
+};
+
+// the generator all of the world generation draws from, seeded in main
+extern CounterRNG GLOBAL_rng;
+
+// ===================================================================
+
+#endif
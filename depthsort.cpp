@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <climits>
+
+#include "depthsort.h"
+#include "parallel.h"
+
+// =======================================================================
+// SORT
+// =======================================================================
+
+bool DepthSorter::sort(const std::vector<int> &items, const std::vector<float> &depth) {
+  frame++;
+  if (requested.size() < depth.size()) {
+    requested.resize(depth.size(), 0);
+    kept.resize(depth.size(), 0);
+  }
+  for (unsigned int i = 0; i < items.size(); i++) {
+    requested[items[i]] = frame;
+  }
+
+  // last frame's order, minus what is gone, plus what is new
+  std::vector<int> next;
+  next.reserve(items.size());
+  for (unsigned int i = 0; i < order.size(); i++) {
+    int item = order[i];
+    if (item < (int)requested.size() && requested[item] == frame) {
+      next.push_back(item);
+      kept[item] = frame;
+    }
+  }
+  for (unsigned int i = 0; i < items.size(); i++) {
+    if (kept[items[i]] != frame) next.push_back(items[i]);
+  }
+
+  // a coherent frame needs a few moves per item at most
+  int max_moves = 8 * next.size() + 64;
+  if (!insertionSort(next, depth, max_moves)) {
+    // the radix sort only orders by the quantized depth, which leaves
+    // little for the insertion sort to finish
+    radixSort(next, depth);
+    insertionSort(next, depth, INT_MAX);
+  }
+
+  bool changed = (next != order);
+  order.swap(next);
+  return changed;
+}
+
+// =======================================================================
+// HELPER FUNCTIONS
+// =======================================================================
+
+// farthest first; returns false (leaving the items partly sorted) if it
+// would take more than max_moves moves
+bool DepthSorter::insertionSort(std::vector<int> &items, const std::vector<float> &depth, int max_moves) const {
+  int moves = 0;
+  for (unsigned int i = 1; i < items.size(); i++) {
+    int item = items[i];
+    float d = depth[item];
+    int j = i;
+    while (j > 0 && depth[items[j-1]] < d) {
+      items[j] = items[j-1];
+      j--;
+      moves++;
+    }
+    items[j] = item;
+    if (moves > max_moves) return false;
+  }
+  return true;
+}
+
+// one pass of an LSD radix sort on 8 bits of the key, stable, with
+// every part taking a contiguous piece of the input
+static void radixPass(const std::vector<int> &in, std::vector<int> &out,
+                      const std::vector<unsigned short> &keys, int shift, int num_parts) {
+  int n = in.size();
+  std::vector<std::vector<int> > counts(num_parts, std::vector<int>(256, 0));
+
+  // histogram of each part
+  runParts(num_parts, [&](int t) {
+      int first = (long long)n * t / num_parts;
+      int last = (long long)n * (t+1) / num_parts;
+      for (int i = first; i < last; i++) counts[t][(keys[in[i]] >> shift) & 255]++;
+    });
+
+  // where each part writes each digit: after all of the smaller
+  // digits, and after this digit from the earlier parts
+  int offset = 0;
+  for (int digit = 0; digit < 256; digit++) {
+    for (int t = 0; t < num_parts; t++) {
+      int c = counts[t][digit];
+      counts[t][digit] = offset;
+      offset += c;
+    }
+  }
+
+  runParts(num_parts, [&](int t) {
+      int first = (long long)n * t / num_parts;
+      int last = (long long)n * (t+1) / num_parts;
+      for (int i = first; i < last; i++) out[counts[t][(keys[in[i]] >> shift) & 255]++] = in[i];
+    });
+}
+
+void DepthSorter::radixSort(std::vector<int> &items, const std::vector<float> &depth) const {
+  if (items.empty()) return;
+
+  // quantize so that the farthest item gets the smallest key
+  float lo = depth[items[0]], hi = depth[items[0]];
+  for (unsigned int i = 1; i < items.size(); i++) {
+    lo = std::min(lo, depth[items[i]]);
+    hi = std::max(hi, depth[items[i]]);
+  }
+  float scale = (hi > lo) ? 65535.0f / (hi - lo) : 0;
+  std::vector<unsigned short> keys(depth.size());
+  for (unsigned int i = 0; i < items.size(); i++) {
+    keys[items[i]] = (unsigned short)((hi - depth[items[i]]) * scale);
+  }
+
+  // small sorts are not worth starting threads for
+  int num_parts = numParts(items.size(), 4096);
+  std::vector<int> temp(items.size());
+  radixPass(items, temp, keys, 0, num_parts);
+  radixPass(temp, items, keys, 8, num_parts);
+}
+
+// =======================================================================
@@ -0,0 +1,49 @@
+#ifndef _DEPTH_SORT_H_
+#define _DEPTH_SORT_H_
+
+#include <vector>
+
+// ===================================================================
+// Back to front ordering of blended geometry that changes a little
+// from one frame to the next.
+//
+// Each call starts from the order of the previous call (items that
+// are no longer drawn are dropped, new ones go at the end) and fixes
+// it with an insertion sort, which is close to linear when the camera
+// has only moved a bit.  If the insertion sort has to move too many
+// items, as after a jump or a sharp turn, it gives up and the items
+// are radix sorted on their depth quantized to 16 bits instead, with
+// the passes split between the cores for large inputs, and the
+// insertion sort finishes the job.
+
+class DepthSorter {
+
+public:
+
+  DepthSorter() : frame(0) {}
+
+  // Order the items (indices into depth) farthest first.  Returns true
+  // if the order differs from the one of the last call.
+  bool sort(const std::vector<int> &items, const std::vector<float> &depth);
+
+  const std::vector<int>& getOrder() const { return order; }
+
+private:
+
+  // helper functions
+  bool insertionSort(std::vector<int> &items, const std::vector<float> &depth, int max_moves) const;
+  void radixSort(std::vector<int> &items, const std::vector<float> &depth) const;
+
+  // ==============
+  // REPRESENTATION
+  std::vector<int> order;
+  // which frame each item was last asked for and last kept in, so the
+  // previous order can be filtered without searching
+  std::vector<int> requested;
+  std::vector<int> kept;
+  int frame;
+};
+
+// ===================================================================
+
+#endif
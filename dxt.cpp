@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "glCanvas.h"
+#include "dxt.h"
+#include "jobsystem.h"
+
+// =======================================================================
+// BLOCK ENCODING
+// =======================================================================
+
+static int blockBytes(DXTFormat format) {
+  return (format == DXT_BC1) ? 8 : 16;
+}
+
+int DXTCompressedSize(int width, int height, DXTFormat format) {
+  return ((width+3)/4) * ((height+3)/4) * blockBytes(format);
+}
+
+static unsigned short pack565(const int c[3]) {
+  return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+static void unpack565(unsigned short p, int c[3]) {
+  // replicate the high bits into the low ones, as the hardware does
+  int r = (p >> 11) & 31, g = (p >> 5) & 63, b = p & 31;
+  c[0] = (r << 3) | (r >> 2);
+  c[1] = (g << 2) | (g >> 4);
+  c[2] = (b << 3) | (b >> 2);
+}
+
+// 8 bytes: two 5:6:5 endpoints and 16 two bit palette indices
+static void encodeColorBlock(const unsigned char *block, unsigned char *out) {
+  int lo[3] = { 255, 255, 255 };
+  int hi[3] = { 0, 0, 0 };
+  int mean[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], (int)block[4*i+c]);
+      hi[c] = std::max(hi[c], (int)block[4*i+c]);
+      mean[c] += block[4*i+c];
+    }
+  }
+  for (int c = 0; c < 3; c++) mean[c] /= 16;
+
+  // the box has four diagonals; use the one that follows how red and
+  // blue change with green
+  int covRG = 0, covBG = 0;
+  for (int i = 0; i < 16; i++) {
+    int g = block[4*i+1] - mean[1];
+    covRG += (block[4*i] - mean[0]) * g;
+    covBG += (block[4*i+2] - mean[2]) * g;
+  }
+  if (covRG < 0) std::swap(lo[0], hi[0]);
+  if (covBG < 0) std::swap(lo[2], hi[2]);
+
+  // pull the endpoints in a little, so the palette covers the bulk of
+  // the colors rather than the outliers
+  for (int c = 0; c < 3; c++) {
+    int inset = (hi[c] - lo[c]) / 16;
+    hi[c] -= inset;
+    lo[c] += inset;
+  }
+
+  unsigned short c0 = pack565(hi);
+  unsigned short c1 = pack565(lo);
+  // c0 > c1 selects the four color (opaque) mode
+  if (c0 < c1) std::swap(c0, c1);
+
+  unsigned int indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestDist = 1 << 30;
+      for (int k = 0; k < 4; k++) {
+        int dist = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = block[4*i+c] - palette[k][c];
+          dist += d*d;
+        }
+        if (dist < bestDist) { bestDist = dist; best = k; }
+      }
+      indices |= best << (2*i);
+    }
+  }
+
+  out[0] = c0 & 255; out[1] = c0 >> 8;
+  out[2] = c1 & 255; out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) out[4+i] = (indices >> (8*i)) & 255;
+}
+
+// 8 bytes: two alpha endpoints and 16 three bit palette indices
+static void encodeAlphaBlock(const unsigned char *block, unsigned char *out) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = std::min(lo, (int)block[4*i+3]);
+    hi = std::max(hi, (int)block[4*i+3]);
+  }
+
+  unsigned long long indices = 0;
+  if (hi != lo) {
+    // a0 > a1 selects the eight value mode
+    int palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int k = 2; k < 8; k++) {
+      palette[k] = ((8-k)*hi + (k-1)*lo) / 7;
+    }
+    for (int i = 0; i < 16; i++) {
+      int a = block[4*i+3];
+      int best = 0, bestDist = 256;
+      for (int k = 0; k < 8; k++) {
+        int dist = abs(a - palette[k]);
+        if (dist < bestDist) { bestDist = dist; best = k; }
+      }
+      indices |= (unsigned long long)best << (3*i);
+    }
+  }
+
+  out[0] = hi;
+  out[1] = lo;
+  for (int i = 0; i < 6; i++) out[2+i] = (indices >> (8*i)) & 255;
+}
+
+// compress the rows of blocks [first, last)
+static void compressRows(const unsigned char *rgba, int width, int height,
+                         DXTFormat format, unsigned char *out, int first, int last) {
+  int blocksWide = (width+3)/4;
+  int bytes = blockBytes(format);
+  unsigned char block[64];
+  for (int by = first; by < last; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      for (int i = 0; i < 16; i++) {
+        int x = std::min(bx*4 + i%4, width-1);
+        int y = std::min(by*4 + i/4, height-1);
+        memcpy(&block[4*i], &rgba[4*(y*width + x)], 4);
+      }
+      unsigned char *dst = out + (by*blocksWide + bx)*bytes;
+      if (format == DXT_BC3) {
+        encodeAlphaBlock(block, dst);
+        dst += 8;
+      }
+      encodeColorBlock(block, dst);
+    }
+  }
+}
+
+void DXTCompress(const unsigned char *rgba, int width, int height,
+                 DXTFormat format, DXTLevel &out) {
+  out.width = width;
+  out.height = height;
+  out.data.resize(DXTCompressedSize(width, height, format));
+
+  // jobs of 16 rows of blocks, so small images stay on one thread
+  int blocksHigh = (height+3)/4;
+  unsigned char *dst = &out.data[0];
+  GLOBAL_jobs.parallelFor(0, blocksHigh, 16, [&](int first, int last) {
+    compressRows(rgba, width, height, format, dst, first, last);
+  });
+}
+
+void DXTCompressChain(const std::vector<std::vector<unsigned char> > &levels,
+                      int width, int height, DXTFormat format,
+                      std::vector<DXTLevel> &out) {
+  out.resize(levels.size());
+  for (unsigned int i = 0; i < levels.size(); i++) {
+    DXTCompress(&levels[i][0], width, height, format, out[i]);
+    width = std::max(1, width/2);
+    height = std::max(1, height/2);
+  }
+}
+
+// =======================================================================
+// OPENGL
+// =======================================================================
+
+static GLenum glFormat(DXTFormat format) {
+  return (format == DXT_BC1) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+bool DXTSupported() {
+  static int supported = -1;
+  if (supported == -1) {
+    const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+    supported = (extensions != NULL && strstr(extensions, "GL_EXT_texture_compression_s3tc") != NULL);
+  }
+  return supported == 1;
+}
+
+void DXTUpload(const std::vector<DXTLevel> &levels, DXTFormat format) {
+  for (unsigned int i = 0; i < levels.size(); i++) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, i, glFormat(format),
+                           levels[i].width, levels[i].height, 0,
+                           levels[i].data.size(), &levels[i].data[0]);
+  }
+}
+
+void DXTAllocate(int width, int height, int num_levels, DXTFormat format) {
+  for (int i = 0; i < num_levels; i++) {
+    glTexImage2D(GL_TEXTURE_2D, i, glFormat(format), std::max(1, width >> i), std::max(1, height >> i),
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  }
+}
+
+void DXTUploadRegion(const std::vector<DXTLevel> &levels, DXTFormat format, int x, int y) {
+  for (unsigned int i = 0; i < levels.size(); i++) {
+    assert ((x >> i) % 4 == 0 && (y >> i) % 4 == 0);
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, i, x >> i, y >> i,
+                              levels[i].width, levels[i].height, glFormat(format),
+                              levels[i].data.size(), &levels[i].data[0]);
+  }
+}
+
+// =======================================================================
+// DISK CACHE
+// =======================================================================
+
+static const char CACHE_MAGIC[4] = { 'D', 'X', 'T', '1' };
+
+bool DXTLoadCache(const std::string &filename, const std::string &source,
+                  int width, int height, DXTFormat format, std::vector<DXTLevel> &levels) {
+  struct stat cacheStat, sourceStat;
+  if (stat(filename.c_str(), &cacheStat) != 0) return false;
+  if (stat(source.c_str(), &sourceStat) == 0 && sourceStat.st_mtime > cacheStat.st_mtime) return false;
+
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == NULL) return false;
+  // a full chain goes down to 1x1, so it is never longer than this
+  int max_levels = 1;
+  for (int d = std::max(width, height); d > 1; d /= 2) max_levels++;
+  char magic[4];
+  int header[2];
+  bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, CACHE_MAGIC, 4) == 0 &&
+    fread(header, sizeof(int), 2, file) == 2 && header[0] == format &&
+    header[1] > 0 && header[1] <= max_levels;
+  if (ok) {
+    levels.resize(header[1]);
+    for (unsigned int i = 0; ok && i < levels.size(); i++) {
+      // each level has to be the one DXTCompressChain makes for the
+      // texture, or the cache is of some other image
+      int size[2];
+      ok = fread(size, sizeof(int), 2, file) == 2 && size[0] == width && size[1] == height;
+      if (!ok) break;
+      levels[i].width = size[0];
+      levels[i].height = size[1];
+      width = std::max(1, width/2);
+      height = std::max(1, height/2);
+      levels[i].data.resize(DXTCompressedSize(size[0], size[1], format));
+      ok = fread(&levels[i].data[0], 1, levels[i].data.size(), file) == levels[i].data.size();
+    }
+  }
+  fclose(file);
+  if (!ok) levels.clear();
+  return ok;
+}
+
+bool DXTSaveCache(const std::string &filename, DXTFormat format,
+                  const std::vector<DXTLevel> &levels) {
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == NULL) return false;
+  int header[2] = { format, (int)levels.size() };
+  fwrite(CACHE_MAGIC, 1, 4, file);
+  fwrite(header, sizeof(int), 2, file);
+  for (unsigned int i = 0; i < levels.size(); i++) {
+    int size[2] = { levels[i].width, levels[i].height };
+    fwrite(size, sizeof(int), 2, file);
+    fwrite(&levels[i].data[0], 1, levels[i].data.size(), file);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+// =======================================================================
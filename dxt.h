@@ -0,0 +1,66 @@
+#ifndef _DXT_H_
+#define _DXT_H_
+
+#include <string>
+#include <vector>
+
+// ===================================================================
+// A small BC1/BC3 (DXT1/DXT5) block encoder.
+//
+// Images are compressed in 4x4 blocks: BC1 stores two 5:6:5 endpoint
+// colors and a 2 bit index per texel (8 bytes a block, no alpha), BC3
+// adds a block of interpolated alpha in front of that (16 bytes a
+// block).  Endpoints come from the inset bounding box of the block's
+// colors, which is fast and good enough for foliage and bark.  Sizes
+// that are not a multiple of 4 are padded by repeating the last row
+// and column, so the 2x2 and 1x1 ends of a mip chain work too.
+
+enum DXTFormat { DXT_BC1, DXT_BC3 };
+
+// one compressed mip level
+struct DXTLevel {
+  DXTLevel(int w = 0, int h = 0) : width(w), height(h) {}
+  int width;
+  int height;
+  std::vector<unsigned char> data;
+};
+
+// the number of bytes a compressed image of this size takes
+int DXTCompressedSize(int width, int height, DXTFormat format);
+
+// compress an image with 4 bytes (RGBA) per texel, row by row, as
+// jobs of GLOBAL_jobs for the larger images
+void DXTCompress(const unsigned char *rgba, int width, int height,
+                 DXTFormat format, DXTLevel &out);
+
+// compress every level of a mip chain, each RGBA and half the size of
+// the one before it
+void DXTCompressChain(const std::vector<std::vector<unsigned char> > &levels,
+                      int width, int height, DXTFormat format,
+                      std::vector<DXTLevel> &out);
+
+// ===================================================================
+// OpenGL and disk cache helpers
+
+// true if the driver takes S3TC compressed textures
+bool DXTSupported();
+
+// upload a compressed mip chain to the currently bound GL_TEXTURE_2D
+void DXTUpload(const std::vector<DXTLevel> &levels, DXTFormat format);
+// make room for num_levels compressed mip levels in the bound texture,
+// and fill part of them with a mip chain whose first level goes at x, y
+// (each level at x, y halved, which has to stay on a block boundary)
+void DXTAllocate(int width, int height, int num_levels, DXTFormat format);
+void DXTUploadRegion(const std::vector<DXTLevel> &levels, DXTFormat format, int x, int y);
+
+// read and write a compressed mip chain; loading fails if the file is
+// missing, in another format, older than the source file, or not a mip
+// chain of a width x height texture
+bool DXTLoadCache(const std::string &filename, const std::string &source,
+                  int width, int height, DXTFormat format, std::vector<DXTLevel> &levels);
+bool DXTSaveCache(const std::string &filename, DXTFormat format,
+                  const std::vector<DXTLevel> &levels);
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#include "ecology.h"
+#include "simdmath.h"
+
+// =======================================================================
+// CONSTRUCTOR
+// =======================================================================
+
+EcologyRules::EcologyRules() {
+  water_level = -2.0f;
+  shore_width = 0.5f;
+  tree_line = 4.0f;
+  tree_line_width = 1.5f;
+  max_slope = 40;
+  slope_width = 10;
+  moisture_range = 20;
+  dry_density = 0.75f;
+}
+
+// =======================================================================
+// DENSITY
+// =======================================================================
+
+// 0 at or below edge0, 1 at or above edge1, linear in between
+static inline float ramp(float x, float edge0, float edge1) {
+  return std::min(1.0f, std::max(0.0f, (x - edge0) / std::max(edge1 - edge0, 1e-6f)));
+}
+
+static inline Float8 ramp(const Float8 &x, float edge0, float edge1) {
+  return min(Float8(1.0f), max(Float8(0.0f), (x - Float8(edge0)) / Float8(std::max(edge1 - edge0, 1e-6f))));
+}
+
+std::vector<float> EcologyRules::densityMap(const std::vector<std::vector<float> > &heights, float spacing) const {
+  int n = heights.size();
+  int count = n*n;
+  assert (n >= 2);
+
+  // flatten the heights so the passes below are straight loops
+  std::vector<float> h(count);
+  for (int i = 0; i < n; i++) {
+    assert ((int)heights[i].size() == n);
+    std::copy(heights[i].begin(), heights[i].end(), h.begin() + i*n);
+  }
+
+  // the y component of the unit normal, from central differences (one
+  // sided at the edges); the slope angle is acos(ny)
+  std::vector<float> ny(count);
+  for (int i = 0; i < n; i++) {
+    int i0 = std::max(0, i-1), i1 = std::min(n-1, i+1);
+    const float *below = &h[i0*n], *above = &h[i1*n], *row = &h[i*n];
+    float *out = &ny[i*n];
+    float di = (i1 - i0) * spacing;
+    // the inside of the row 8 at a time, then the rest and the ends
+    int j = 1;
+    const Float8 di8 (di), dj8 (2 * spacing), one (1.0f);
+    for (; j + 8 <= n - 1; j += 8) {
+      Float8 dx = (Float8::load(above + j) - Float8::load(below + j)) / di8;
+      Float8 dz = (Float8::load(row + j + 1) - Float8::load(row + j - 1)) / dj8;
+      (one / sqrt(dx*dx + one + dz*dz)).store(out + j);
+    }
+    for (int k = 0; k < n; k++) {
+      if (k >= 1 && k < j) continue;
+      int j0 = std::max(0, k-1), j1 = std::min(n-1, k+1);
+      float dx = (above[k] - below[k]) / di;
+      float dz = (row[j1] - row[j0]) / ((j1 - j0) * spacing);
+      out[k] = 1.0f / sqrt(dx*dx + 1.0f + dz*dz);
+    }
+  }
+
+  std::vector<float> water = waterDistance(h, n, spacing, water_level);
+
+  // compare normals against the cosines of the slope limits, which
+  // keeps acos out of the loop
+  float cos_full = cos(std::max(0.0f, max_slope - slope_width) * M_PI / 180.0);
+  float cos_none = cos(max_slope * M_PI / 180.0);
+  float shore_top = water_level + shore_width;
+  float line_bottom = tree_line - tree_line_width;
+
+  std::vector<float> density(count);
+  int k = 0;
+  for (; k + 8 <= count; k += 8) {
+    Float8 height = Float8::load(&h[k]);
+    Float8 altitude = ramp(height, water_level, shore_top) * (Float8(1.0f) - ramp(height, line_bottom, tree_line));
+    Float8 slope = ramp(Float8::load(&ny[k]), cos_none, cos_full);
+    Float8 moisture = Float8(dry_density) + Float8(1.0f - dry_density) * (Float8(1.0f) - ramp(Float8::load(&water[k]), 0.0f, moisture_range));
+    (altitude * slope * moisture).store(&density[k]);
+  }
+  for (; k < count; k++) {
+    float altitude = ramp(h[k], water_level, shore_top) * (1.0f - ramp(h[k], line_bottom, tree_line));
+    float slope = ramp(ny[k], cos_none, cos_full);
+    float moisture = dry_density + (1.0f - dry_density) * (1.0f - ramp(water[k], 0.0f, moisture_range));
+    density[k] = altitude * slope * moisture;
+  }
+  return density;
+}
+
+// the distance from every sample to the nearest one under water, by a
+// two pass chamfer transform; FLT_MAX if there is no water at all
+std::vector<float> EcologyRules::waterDistance(const std::vector<float> &h, int n, float spacing, float level) {
+  const float diagonal = spacing * sqrt(2.0f);
+  std::vector<float> d(n*n);
+  for (int k = 0; k < n*n; k++) d[k] = (h[k] <= level) ? 0 : FLT_MAX;
+
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      float &v = d[i*n+j];
+      if (i > 0) v = std::min(v, d[(i-1)*n+j] + spacing);
+      if (j > 0) v = std::min(v, d[i*n+j-1] + spacing);
+      if (i > 0 && j > 0) v = std::min(v, d[(i-1)*n+j-1] + diagonal);
+      if (i > 0 && j+1 < n) v = std::min(v, d[(i-1)*n+j+1] + diagonal);
+    }
+  }
+  for (int i = n-1; i >= 0; i--) {
+    for (int j = n-1; j >= 0; j--) {
+      float &v = d[i*n+j];
+      if (i+1 < n) v = std::min(v, d[(i+1)*n+j] + spacing);
+      if (j+1 < n) v = std::min(v, d[i*n+j+1] + spacing);
+      if (i+1 < n && j+1 < n) v = std::min(v, d[(i+1)*n+j+1] + diagonal);
+      if (i+1 < n && j > 0) v = std::min(v, d[(i+1)*n+j-1] + diagonal);
+    }
+  }
+  return d;
+}
+
+std::vector<float> EcologyRules::blockLambdas(const std::vector<float> &density, int samples_per_side, float lambda) {
+  int n = samples_per_side;
+  int blocks = n - 1;
+  assert ((int)density.size() == n*n);
+  std::vector<float> lambdas(blocks*blocks);
+  for (int i = 0; i < blocks; i++) {
+    const float *row0 = &density[i*n], *row1 = &density[(i+1)*n];
+    float *out = &lambdas[i*blocks];
+    for (int j = 0; j < blocks; j++) {
+      out[j] = lambda * 0.25f * (row0[j] + row0[j+1] + row1[j] + row1[j+1]);
+    }
+  }
+  return lambdas;
+}
+
+// =======================================================================
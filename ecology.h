@@ -0,0 +1,58 @@
+#ifndef _ECOLOGY_H_
+#define _ECOLOGY_H_
+
+#include <vector>
+
+// ===================================================================
+// Rules for where trees grow on the terrain.
+//
+// Each rule gives a factor from 0 (nothing grows) to 1 (full density)
+// at every terrain sample, with a soft edge instead of a hard cutoff:
+//   altitude - between the water's edge and the tree line
+//   slope    - flatter than max_slope, from the terrain normals
+//   water    - nothing under water, and denser close to the shore
+//              (within moisture_range), falling to dry_density
+// The product of the factors is the density map, on the same grid as
+// the heights.  Every rule is a branch free loop over flat arrays of
+// samples, so the compiler can vectorize the whole pass.
+
+class EcologyRules {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  EcologyRules();
+
+  // ==========
+  // PARAMETERS
+  // all heights and distances are in world units, angles in degrees
+  float water_level;
+  float shore_width;      // from the water up to full density
+  float tree_line;
+  float tree_line_width;  // from full density up to the tree line
+  float max_slope;
+  float slope_width;      // from full density up to max_slope
+  float moisture_range;
+  float dry_density;      // the water factor far from water
+
+  // ========
+  // DENSITY
+  // A square heightfield of (n+1)x(n+1) samples, spacing apart, with
+  // heights[i][j] at (i*spacing, heights[i][j], j*spacing), as made by
+  // TerrainGenerator.  The result is indexed [i*(n+1) + j].
+  std::vector<float> densityMap(const std::vector<std::vector<float> > &heights, float spacing) const;
+
+  // The expected number of trees in each of the n x n blocks between the
+  // samples, from the average density at the block's corners
+  static std::vector<float> blockLambdas(const std::vector<float> &density, int samples_per_side, float lambda);
+
+private:
+
+  // helper functions
+  static std::vector<float> waterDistance(const std::vector<float> &h, int n, float spacing, float level);
+};
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,109 @@
+#include <algorithm>
+
+#include "edgehashmap.h"
+
+// the table grows when it is 7/8 full
+static const int MIN_CAPACITY = 16;
+static inline bool overfull(int entries, int capacity) {
+  return entries * 8 > capacity * 7;
+}
+
+// =======================================================================
+// LOOKUP
+// =======================================================================
+
+int EdgeHashMap::findSlot(uint64 key) const {
+  int slot = mix(key) & mask;
+  for (int distance = 1; ; distance++) {
+    // an entry closer to home than we are means the key is not here,
+    // it would have taken that entry's place
+    if (distances[slot] < distance) return -1;
+    if (keys[slot] == key) return slot;
+    slot = (slot + 1) & mask;
+  }
+}
+
+// =======================================================================
+// MODIFIERS
+// =======================================================================
+
+void EdgeHashMap::insert(const Vertex *a, const Vertex *b, Edge *e) {
+  assert (e != NULL);
+  if (overfull(num_entries + 1, distances.size()))
+    rehash(std::max(MIN_CAPACITY, (int)distances.size() * 2));
+  uint64 key = makeKey(a, b);
+  assert (findSlot(key) < 0);
+  place(key, e);
+  num_entries++;
+}
+
+void EdgeHashMap::place(uint64 key, Edge *value) {
+  int slot = mix(key) & mask;
+  unsigned short distance = 1;
+  while (distances[slot] != 0) {
+    // take the place of an entry that is closer to its home, and
+    // carry on with that one instead
+    if (distances[slot] < distance) {
+      std::swap(keys[slot], key);
+      std::swap(values[slot], value);
+      std::swap(distances[slot], distance);
+    }
+    slot = (slot + 1) & mask;
+    distance++;
+  }
+  keys[slot] = key;
+  values[slot] = value;
+  distances[slot] = distance;
+}
+
+bool EdgeHashMap::erase(const Vertex *a, const Vertex *b) {
+  if (num_entries == 0) return false;
+  int slot = findSlot(makeKey(a, b));
+  if (slot < 0) return false;
+  // move the entries after it one slot back, until one is at home
+  int next = (slot + 1) & mask;
+  while (distances[next] > 1) {
+    keys[slot] = keys[next];
+    values[slot] = values[next];
+    distances[slot] = distances[next] - 1;
+    slot = next;
+    next = (next + 1) & mask;
+  }
+  distances[slot] = 0;
+  values[slot] = NULL;
+  num_entries--;
+  return true;
+}
+
+void EdgeHashMap::reserve(int n) {
+  int capacity = std::max(MIN_CAPACITY, (int)distances.size());
+  while (overfull(n, capacity)) capacity *= 2;
+  if (capacity != (int)distances.size()) rehash(capacity);
+}
+
+void EdgeHashMap::clear() {
+  keys.clear();
+  values.clear();
+  distances.clear();
+  num_entries = 0;
+  mask = 0;
+}
+
+void EdgeHashMap::rehash(int capacity) {
+  assert ((capacity & (capacity - 1)) == 0);
+  std::vector<uint64> old_keys;
+  std::vector<Edge*> old_values;
+  std::vector<unsigned short> old_distances;
+  old_keys.swap(keys);
+  old_values.swap(values);
+  old_distances.swap(distances);
+  keys.assign(capacity, 0);
+  values.assign(capacity, (Edge*)NULL);
+  distances.assign(capacity, 0);
+  mask = capacity - 1;
+  for (unsigned int i = 0; i < old_distances.size(); i++) {
+    if (old_distances[i] != 0) place(old_keys[i], old_values[i]);
+  }
+}
+
+// =======================================================================
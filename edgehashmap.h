@@ -0,0 +1,106 @@
+#ifndef _EDGE_HASH_MAP_H_
+#define _EDGE_HASH_MAP_H_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#include "vertex.h"
+
+class Edge;
+
+// ===================================================================
+// The directed edges of a mesh, looked up by their start and end
+// vertices.
+//
+// The key is the two vertex indices packed into 64 bits, so comparing
+// keys never touches the vertices, and it goes through a 64 bit mixer
+// (the finalizer of MurmurHash3) so that the many edges between
+// neighboring indices spread over the whole table.  The table is open
+// addressing with Robin Hood probing: an entry that has come further
+// from its home slot takes the place of one that has not, which keeps
+// every probe sequence short even when the table is nearly full.
+// Erasing shifts the entries after it back, so there are no
+// tombstones.  Keys, values and probe distances are in separate flat
+// arrays.
+
+class EdgeHashMap {
+
+public:
+
+  typedef unsigned long long uint64;
+
+  // ========================
+  // CONSTRUCTOR
+  EdgeHashMap() : num_entries(0), mask(0) {}
+
+  // =========
+  // ACCESSORS
+  int size() const { return num_entries; }
+  bool empty() const { return num_entries == 0; }
+  // the edge from a to b, NULL if there is none
+  Edge* find(const Vertex *a, const Vertex *b) const {
+    if (num_entries == 0) return NULL;
+    int slot = findSlot(makeKey(a, b));
+    return (slot < 0) ? NULL : values[slot];
+  }
+
+  // =========
+  // MODIFIERS
+  // add the edge from a to b, which must not be in the table yet
+  void insert(const Vertex *a, const Vertex *b, Edge *e);
+  // remove the edge from a to b, returns false if it was not there
+  bool erase(const Vertex *a, const Vertex *b);
+  // make room for n edges in all, so that adding them never rehashes
+  void reserve(int n);
+  void clear();
+
+  // =========
+  // ITERATION over the edges, in no particular order
+  class const_iterator {
+  public:
+    const_iterator(const EdgeHashMap *m, int s) : map(m), slot(s) { skip(); }
+    Edge* operator*() const { return map->values[slot]; }
+    const_iterator& operator++() { slot++; skip(); return *this; }
+    bool operator==(const const_iterator &i) const { return slot == i.slot; }
+    bool operator!=(const const_iterator &i) const { return slot != i.slot; }
+  private:
+    void skip() { while (slot < (int)map->distances.size() && map->distances[slot] == 0) slot++; }
+    const EdgeHashMap *map;
+    int slot;
+  };
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, distances.size()); }
+
+private:
+
+  // helper functions
+  static uint64 makeKey(const Vertex *a, const Vertex *b) {
+    return ((uint64)(unsigned int)a->getIndex() << 32) | (unsigned int)b->getIndex();
+  }
+  static uint64 mix(uint64 k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+  int findSlot(uint64 key) const;
+  void place(uint64 key, Edge *value);
+  void rehash(int capacity);
+
+  // ==============
+  // REPRESENTATION
+  std::vector<uint64> keys;
+  std::vector<Edge*> values;
+  // 1 + how far each entry is from its home slot, 0 for an empty slot
+  std::vector<unsigned short> distances;
+  int num_entries;
+  // the capacity (a power of 2) minus 1
+  int mask;
+};
+
+// ===================================================================
+
+#endif
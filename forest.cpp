@@ -1,21 +1,66 @@
 #include "forest.h"
+#include "ecology.h"
 #include "seeder.h"
 
 #include "argparser.h"
+#include "counterrng.h"
 #include "hemisphere.h"
+#include "jobsystem.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "simdmath.h"
 #include "terraingenerator.h"
+#include "utils.h"
 #include "view.h"
+#include "worldsnapshot.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 #include <iostream>
 
 // helper for VBOs
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
-Forest::Forest(ArgParser *a, Hemisphere *h) : args(a), hemisphere(h), 
+//  Ordered dither matrix for the mesh/impostor cross-fade
+static const int bayer4[4][4] = {
+  { 0,  8,  2, 10},
+  {12,  4, 14,  6},
+  { 3, 11,  1,  9},
+  {15,  7, 13,  5},
+};
+
+//  Returns a polygon stipple with level of every 16 pixels set, the
+//  ones whose dither value is below level.  The inverted stipple sets
+//  exactly the other pixels, so a surface drawn with a level and one
+//  drawn with the same level inverted cover each pixel exactly once.
+static const GLubyte* getFadeStipple(int level, bool invert = false) {
+  static GLubyte patterns[2][17][128];
+  static bool initialized = false;
+  if (!initialized) {
+    for (int l = 0; l <= 16; ++l) {
+      for (int y = 0; y < 32; ++y) {
+        for (int b = 0; b < 4; ++b) {
+          GLubyte bits = 0;
+          for (int x = 0; x < 8; ++x) {
+            if (bayer4[y % 4][x % 4] < l) bits |= 0x80 >> x;
+          }
+          patterns[0][l][y*4 + b] = bits;
+          patterns[1][l][y*4 + b] = ~bits;
+        }
+      }
+    }
+    initialized = true;
+  }
+  assert(level >= 0 && level <= 16);
+  return patterns[invert ? 1 : 0][level];
+}
+
+Forest::Forest(ArgParser *a, const std::vector<Mesh*> &m, const std::vector<Hemisphere*> &h) :
+                                              args(a), meshes(m), hemispheres(h),
+                                              tree_cells_changed(false), tree_density(1),
                                               num_trees(0), tree_size(5),
-                                              tree_buffer_set(false) {
+                                              tree_buffer_set(false), tree_world_space(false), camera(NULL) {
 
   //  Note: num_blocks must be a power of two, squared, i.e. (2^x)^2
   num_blocks = pow(pow(2, 4), 2);
@@ -28,30 +73,111 @@ Forest::Forest(ArgParser *a, Hemisphere *h) : args(a), hemisphere(h),
   cT = Vec3f(tree_size / 2.0f,  0,  0);
   dT = Vec3f(-tree_size / 2.0f, tree_size,  0);
 
-  Seeder seeder = Seeder(2);
-  //  Get the block-space coordinates of each tree
-  tree_locations = seeder.getTreeLocations(area, num_blocks, tree_size);
+  mesh_distance = args->mesh_distance;
+  fade_width = tree_size * 2;
+  mesh_hysteresis = 0.1f;
+  mesh_budget = args->mesh_budget;
+  num_tree_quad_indices = 0;
+  forest_quad_indices_VBO = 0;
+  forest_quad_texcoords_VBO = 0;
+
+  cluster_distance = args->cluster_distance;
+  cluster_hysteresis = 0.1f;
+  cluster_refresh_angle = 5 * M_PI / 180;
+  billboard_step = 0.5 * M_PI / 180;
+  billboard_merge_gap = 8;
+  tree_quads_version = 0;
+  tree_quads_uploaded = -1;
+  cluster_cell_size = 128;
+  cluster_atlas_cells = (int)ceil(sqrt((double)num_blocks));
+  block_impostors = std::vector<BlockImpostor> (num_blocks);
+  block_is_cluster = std::vector<bool> (num_blocks, false);
+  num_cluster_quads = 0;
+  occlusion_culling = args->occlusion_culling;
+  block_min = std::vector<Vec3f> (num_blocks);
+  block_max = std::vector<Vec3f> (num_blocks);
+  block_visible = std::vector<bool> (num_blocks, true);
+  if (args->alpha_mode == "coverage")
+    alpha_mode = ALPHA_COVERAGE;
+  else if (args->alpha_mode == "alphatest")
+    alpha_mode = ALPHA_TEST;
+  else
+    alpha_mode = ALPHA_BLEND;
+  cluster_atlas = 0;
+  cluster_FBO = 0;
+  cluster_depth_RB = 0;
+}
+
+//  Bring back a saved world, or make a new one, and size everything
+//  that has one entry per tree.  Needs no GL context, so it can run on
+//  a worker thread while the window comes up.
+void Forest::createWorld() {
+  if (args->load_world.empty() || !loadWorld(args->load_world))
+    generateWorld();
+  num_trees = 0;
+  tree_block.clear();
   for (unsigned int i = 0; i < tree_locations.size(); ++i)
   {
     num_trees += tree_locations[i].size();
+    tree_block.insert(tree_block.end(), tree_locations[i].size(), i);
+  }
+
+  //  Every tree is one of the species, picked by where it is in its
+  //  block, so a saved world gets the same species back from its seed.
+  //  The thinning rank comes the same way.
+  tree_species.clear();
+  tree_thinning.clear();
+  species_trees = std::vector<int> (meshes.size(), 0);
+  for (unsigned int i = 0; i < tree_locations.size(); ++i)
+  {
+    for (unsigned int k = 0; k < tree_locations[i].size(); ++k)
+    {
+      int species = GLOBAL_rng.randInt(RNG_TREE_SPECIES, i, k) % meshes.size();
+      tree_species.push_back(species);
+      tree_thinning.push_back(GLOBAL_rng.randExc(RNG_TREE_THINNING, i, k));
+      ++species_trees[species];
+    }
   }
-  forest_quad_verts_VBO = std::vector<GLuint> (num_trees);
-  forest_quad_indices_VBO = std::vector<GLuint> (num_trees);
-  forest_quad_texcoords_VBO = std::vector<GLuint> (num_trees);
-  forest_quad_textures = std::vector<GLuint> (num_trees);
+  tree_cell = std::vector<int> (num_trees, -1);
+  tree_is_mesh = std::vector<bool> (num_trees, false);
+  tree_bucket = std::vector<int> (num_trees, -1);
+  tree_quad_version = std::vector<int> (num_trees, 0);
+  tree_visible = std::vector<bool> (num_trees, true);
 }
 
 Forest::~Forest() {
 	cleanupVBOs();
 }
 
+//  Make the atlas and share it out between the species, the most
+//  views to the species with the most trees, then make their views
+void Forest::setupSpecies() {
+  //  Every species can do with a hemisphere of 2 levels of 4 views
+  const int minViews = 8;
+  int numSpecies = hemispheres.size();
+  view_atlas.initialize(VIEW_SIZE, (size_t)(args->atlas_budget * 1024 * 1024), minViews * numSpecies);
+  int spare = view_atlas.numCells() - minViews * numSpecies;
+  for (int s = 0; s < numSpecies; ++s)
+  {
+    int views = minViews + (int)((double)spare * species_trees[s] / std::max(num_trees, 1));
+    hemispheres[s]->setAtlas(&view_atlas);
+    hemispheres[s]->limitViews(views);
+    hemispheres[s]->setup();
+    std::cout << "Species " << s << ": " << species_trees[s] << " trees, "
+              << hemispheres[s]->numViews() << " views\n";
+  }
+}
+
 void Forest::initializeVBOs() {
+  setupSpecies();
+
   forest_quad_verts = new VBOTriVert[num_trees*4];
   
-  // create a pointer for the vertex & index VBOs
-  glGenBuffers(num_trees, &forest_quad_verts_VBO[0]);
-  glGenBuffers(num_trees, &forest_quad_indices_VBO[0]);
-  glGenBuffers(num_trees, &forest_quad_texcoords_VBO[0]);
+  // create a pointer for the vertex & index VBOs; the tree quads turn
+  // with the camera, so they are streamed
+  tree_quad_stream.initialize(GL_ARRAY_BUFFER, sizeof(VBOTriVert) * std::max(num_trees, 1) * 4);
+  glGenBuffers(1, &forest_quad_indices_VBO);
+  glGenBuffers(1, &forest_quad_texcoords_VBO);
   // for (int i = 0; i < num_trees; ++i)
   // {
   //   glGenBuffers(1, &forest_quad_verts_VBO[i]);
@@ -62,9 +188,170 @@ void Forest::initializeVBOs() {
   glGenBuffers(1, &gnd_mesh_tri_indices_VBO);
   glGenBuffers(1, &gnd_mesh_verts_VBO);
   // glGenTextures(num_trees, &forest_quad_textures);
+  glGenBuffers(1, &cluster_verts_VBO);
+  glGenBuffers(1, &cluster_texcoords_VBO);
+
+  //  Alpha to coverage needs a multisampled window
+  if (alpha_mode == ALPHA_COVERAGE)
+  {
+    GLint sampleBuffers = 0;
+    glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+    if (sampleBuffers == 0)
+    {
+      std::cerr << "No multisampling available, using the alpha test instead of coverage\n";
+      alpha_mode = ALPHA_TEST;
+    }
+  }
+
+  //  The atlas the far blocks are rendered into, and its framebuffer
+  int atlasSize = cluster_atlas_cells * cluster_cell_size;
+  glGenTextures(1, &cluster_atlas);
+  glBindTexture(GL_TEXTURE_2D, cluster_atlas);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &cluster_FBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, cluster_FBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, cluster_atlas, 0);
+  glGenRenderbuffers(1, &cluster_depth_RB);
+  glBindRenderbuffer(GL_RENDERBUFFER, cluster_depth_RB);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, atlasSize, atlasSize);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, cluster_depth_RB);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cerr << "Cluster FBO setup failed, far blocks will draw every tree\n";
+    cluster_distance = FLT_MAX;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  HandleGLError("After setting up cluster FBO");
+
+  //  The views a loaded world was drawn with are the first ones needed
+  for (unsigned int i = 0; i < saved_view_level.size() && i < tree_species.size(); ++i)
+  {
+    hemispheres[tree_species[i]]->hintView(saved_view_level[i], saved_view_point[i]);
+  }
+
   setupVBOs();
 }
 
+//  Generate the terrain and place the trees on it
+void Forest::generateWorld() {
+  //  Tweak some optional parameters and generate terrain heights
+  int sqrtNumBlocks = sqrt(num_blocks);
+  TerrainGenerator::setRatio(0.5f);
+  // TerrainGenerator::setRatio(1.5f);
+  // TerrainGenerator::setRatio(2.0f);
+  // TerrainGenerator::setRatio(2.5f);
+  // TerrainGenerator::setScale(2.0f);
+  // TerrainGenerator::setScale(100.0f);
+  TerrainGenerator::setScale(sqrt(sqrtNumBlocks));
+  terrain_heights = TerrainGenerator::generate(sqrtNumBlocks);
+
+  //  Let the terrain decide where trees grow and how many
+  EcologyRules ecology;
+  ecology.water_level = args->water_level;
+  ecology.tree_line = args->tree_line;
+  ecology.max_slope = args->max_slope;
+  
+  Seeder seeder = Seeder(2);
+  if (args->ecology)
+    seeder.setDensityMap(ecology.densityMap(terrain_heights, sqrt(area / num_blocks)), sqrtNumBlocks + 1);
+
+  //  Get the block-space coordinates of each tree
+  if (args->distribution == "poisson")
+    tree_locations = seeder.getPoissonDiskLocations(area, num_blocks, args->tree_spacing);
+  else
+    tree_locations = seeder.getTreeLocations(area, num_blocks, tree_size);
+}
+
+//  Take the terrain and trees from a world snapshot.  Returns false,
+//  leaving the forest alone, if the file can't be used.
+bool Forest::loadWorld(const std::string &filename) {
+  WorldSnapshot world;
+  if (!world.load(filename))
+    return false;
+  int sqrtNumBlocks = sqrt(num_blocks);
+  if (world.num_blocks != num_blocks || world.area != area || (int)world.heights.size() != sqrtNumBlocks + 1)
+  {
+    std::cerr << "The world in " << filename << " has a different layout, generating a new one\n";
+    return false;
+  }
+
+  terrain_heights = world.heights;
+  tree_locations = world.trees;
+  saved_view_level = world.view_level;
+  saved_view_point = world.view_point;
+
+  //  Carry on from the same seed and settings, so the rest of the run
+  //  and any snapshot saved from it match the original
+  TerrainGenerator::setRatio(world.terrain_ratio);
+  TerrainGenerator::setScale(world.terrain_scale);
+  args->seed = world.seed;
+  args->distribution = world.distribution;
+  args->tree_spacing = world.tree_spacing;
+  args->ecology = world.ecology;
+  args->water_level = world.water_level;
+  args->tree_line = world.tree_line;
+  args->max_slope = world.max_slope;
+  GLOBAL_rng.seed(world.seed);
+  std::cout << "Loaded world " << filename << "\n";
+  return true;
+}
+
+//  Write the terrain, the trees and the views they are drawn with
+void Forest::saveWorld(const std::string &filename) {
+  WorldSnapshot world;
+  world.seed = args->seed;
+  world.terrain_ratio = TerrainGenerator::getRatio();
+  world.terrain_scale = TerrainGenerator::getScale();
+  world.distribution = args->distribution;
+  world.tree_spacing = args->tree_spacing;
+  world.ecology = args->ecology;
+  world.water_level = args->water_level;
+  world.tree_line = args->tree_line;
+  world.max_slope = args->max_slope;
+  world.num_blocks = num_blocks;
+  world.area = area;
+  world.heights = terrain_heights;
+
+  //  The trees are in world space once the VBOs are set up
+  float blockSideLength = sqrt(area / num_blocks);
+  int sqrtNumBlocks = sqrt(num_blocks);
+  world.trees = tree_locations;
+  int tree = 0;
+  for (unsigned int b = 0; b < world.trees.size(); ++b)
+  {
+    for (unsigned int k = 0; k < world.trees[b].size(); ++k, ++tree)
+    {
+      Vec3f treeLoc = world.trees[b][k];
+      if (tree_world_space)
+      {
+        int level, point;
+        hemispheres[tree_species[tree]]->getNearestViewIndex(treeLoc, camera_pos, level, point);
+        world.view_level.push_back(level);
+        world.view_point.push_back(point);
+        treeLoc = treeLoc - Vec3f((b / sqrtNumBlocks) * blockSideLength, treeLoc.y(), (b % sqrtNumBlocks) * blockSideLength);
+      }
+      else
+      {
+        world.view_level.push_back(-1);
+        world.view_point.push_back(-1);
+      }
+      world.trees[b][k] = treeLoc;
+    }
+  }
+
+  if (world.save(filename))
+    std::cout << "Saved world " << filename << "\n";
+}
+
 void Forest::setupVBOs() {
   //  Setup the ground and the trees
   //  Properties of the ground
@@ -78,13 +365,11 @@ void Forest::setupVBOs() {
   Vec3f baseOffset, blockOffset, hVec;
   Vec3f treeLocation;
 
-  VBOQuad* forest_quad_indices;
-  VBOTex* forest_quad_texcoords;
   VBOTriVert* gnd_mesh_tri_verts;
   VBOTri* gnd_mesh_tri_indices;
 
   //  Ground vertex heights
-  std::vector<std::vector<float> > heights;
+  const std::vector<std::vector<float> > &heights = terrain_heights;
   
   blockSideLength = sqrt(area / num_blocks);
 
@@ -100,26 +385,13 @@ void Forest::setupVBOs() {
   
   sqrtNumBlocks = sqrt(num_blocks);
   
-  //  Tweak some optional parameters and generate terrain heights
-  TerrainGenerator::setRatio(0.5f);
-  // TerrainGenerator::setRatio(1.5f);
-  // TerrainGenerator::setRatio(2.0f);
-  // TerrainGenerator::setRatio(2.5f);
-  // TerrainGenerator::setScale(2.0f);
-  // TerrainGenerator::setScale(100.0f);
-  TerrainGenerator::setScale(sqrt(sqrtNumBlocks));
-  heights = TerrainGenerator::generate(sqrtNumBlocks);
+  occlusion_culler.setTerrain(heights, blockSideLength);
   
-  forest_quad_indices = new VBOQuad[num_trees];
-  forest_quad_texcoords = new VBOTex[num_trees*4];
-
   gnd_mesh_tri_verts = new VBOTriVert[num_blocks*4];
   gnd_mesh_tri_indices = new VBOTri[num_blocks*2];
   
   //  Draw ground squares and trees
   int locCounter = 0;
-  int countTrees = 0;
-  countTrees = num_trees-1;
   int blockNumber = 0;
   for (int i = 0; i < sqrtNumBlocks; ++i) {
     baseOffset = cG*i;
@@ -160,25 +432,58 @@ void Forest::setupVBOs() {
         treeLocation.sety(treeHeight);
 
         //  Save the world-space tree coordinate over the block-space coordinate
+        //  The quad to draw the tree on, and the view on it, are made in
+        //  setTreeQuads later
         tree_locations[blockNumber][k] = treeLocation;
-        
-        //  Create the quad to draw the tree on in another function later
-        //  For now just set the vertex indices and texture coordinates
-        forest_quad_indices[countTrees] = VBOQuad(locCounter - 4, locCounter - 3, locCounter - 2, locCounter - 1);
-        forest_quad_texcoords[countTrees*4] = VBOTex(0,0);
-        forest_quad_texcoords[countTrees*4 + 1] = VBOTex(0,1);
-        forest_quad_texcoords[countTrees*4 + 2] = VBOTex(1,1);
-        forest_quad_texcoords[countTrees*4 + 3] = VBOTex(1,0);
-
-        //  Set the texture for this tree
-        forest_quad_textures[countTrees] = hemisphere->getNearestView(treeLocation, camera_pos)->textureID();
-
-        // ++countTrees;
-        --countTrees;
+        tree_world_space = true;
       }
     }
   }
   
+  //  Flatten the tree locations in the order of the tree quads
+  tree_positions.clear();
+  for (unsigned int i = 0; i < tree_locations.size(); ++i)
+  {
+    tree_positions.insert(tree_positions.end(), tree_locations[i].begin(), tree_locations[i].end());
+  }
+  int paddedTrees = (tree_positions.size() + 7) / 8 * 8;
+  quad_center_x = std::vector<float> (paddedTrees, 0);
+  quad_center_y = std::vector<float> (paddedTrees, 0);
+  quad_center_z = std::vector<float> (paddedTrees, 0);
+  for (unsigned int i = 0; i < tree_positions.size(); ++i)
+  {
+    Vec3f center = tree_positions[i] + Vec3f(0, tree_size/2, 0);
+    quad_center_x[i] = center.x();
+    quad_center_y[i] = center.y();
+    quad_center_z[i] = center.z();
+  }
+
+  std::vector<Vec3f> centers (tree_positions.size());
+  for (unsigned int i = 0; i < tree_positions.size(); ++i)
+  {
+    centers[i] = tree_positions[i] + Vec3f(0, tree_size/2.0, 0);
+  }
+  //  A sphere that holds the whole tree
+  tree_grid.build(centers, tree_size * 0.87f);
+
+  //  Bound the trees of each block for the far field
+  for (int i = 0; i < num_blocks; ++i)
+  {
+    if (tree_locations[i].empty()) continue;
+    Vec3f lo(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec3f hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (unsigned int k = 0; k < tree_locations[i].size(); ++k)
+    {
+      Vec3f p = tree_locations[i][k];
+      lo.set(std::min(lo.x(), p.x() - tree_size/2.0), std::min(lo.y(), p.y()), std::min(lo.z(), p.z() - tree_size/2.0));
+      hi.set(std::max(hi.x(), p.x() + tree_size/2.0), std::max(hi.y(), p.y() + tree_size), std::max(hi.z(), p.z() + tree_size/2.0));
+    }
+    block_min[i] = lo;
+    block_max[i] = hi;
+    block_impostors[i].center = (lo + hi) * 0.5;
+    block_impostors[i].radius = (hi - lo).Length() * 0.5;
+  }
+
   setTreeQuads();
 
   glBindBuffer(GL_ARRAY_BUFFER,gnd_mesh_tri_verts_VBO);
@@ -192,17 +497,6 @@ void Forest::setupVBOs() {
                gnd_mesh_tri_indices,
                GL_STATIC_DRAW);
   
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,forest_quad_indices_VBO[0]);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               sizeof(VBOQuad) * num_trees,
-               forest_quad_indices,
-               GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,forest_quad_texcoords_VBO[0]);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               sizeof(VBOTex) * num_trees * 4,
-               forest_quad_texcoords,
-               GL_STATIC_DRAW);
-
   // for (int i = 0; i < num_trees; ++i)
   // {
   //   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,forest_quad_indices_VBO[i]);
@@ -220,21 +514,23 @@ void Forest::setupVBOs() {
   delete [] gnd_mesh_tri_verts;
   delete [] gnd_mesh_tri_indices;
 
-  delete [] forest_quad_indices;
-  delete [] forest_quad_texcoords;
-
   num_gnd_tris = num_blocks * 2;
 }
 
 void Forest::cleanupVBOs() {
   delete [] forest_quad_verts;
   
-  glDeleteBuffers(num_trees, &forest_quad_verts_VBO[0]);
-  glDeleteBuffers(num_trees, &forest_quad_indices_VBO[0]);
-  glDeleteBuffers(num_trees, &forest_quad_texcoords_VBO[0]);
+  tree_quad_stream.cleanup();
+  glDeleteBuffers(1, &forest_quad_indices_VBO);
+  glDeleteBuffers(1, &forest_quad_texcoords_VBO);
   glDeleteBuffers(1, &gnd_mesh_tri_verts_VBO);
   glDeleteBuffers(1, &gnd_mesh_tri_indices_VBO);
   glDeleteBuffers(1, &gnd_mesh_verts_VBO);
+  glDeleteBuffers(1, &cluster_verts_VBO);
+  glDeleteBuffers(1, &cluster_texcoords_VBO);
+  glDeleteTextures(1, &cluster_atlas);
+  glDeleteFramebuffers(1, &cluster_FBO);
+  glDeleteRenderbuffers(1, &cluster_depth_RB);
 }
 
 void Forest::drawVBOs() {
@@ -262,115 +558,236 @@ void Forest::drawVBOs() {
   glDisable( GL_DEPTH_TEST );
 
   glEnable( GL_DEPTH_TEST );
-  // glEnable( GL_MULTISAMPLE_ARB );
-  // glEnable( GL_SAMPLE_ALPHA_TO_COVERAGE );
   glEnable( GL_TEXTURE_2D );
-  glEnable( GL_BLEND );
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  beginAlphaMode();
   glColor3f(1.0,1.0,1.0);
 
-  //  Trees
-  bool many_textures = false;
-  if (many_textures)
+  //  Trees close enough to be drawn with the real mesh
+  for (unsigned int s = 0; s < mesh_instances.size(); ++s)
   {
-    for (int i = 0; i < num_trees; ++i)
+    for (unsigned int i = 0; i < mesh_instances[s].size(); ++i)
     {
-      // glBindBuffer(GL_ARRAY_BUFFER, forest_quad_verts_VBO[i]);
-      // glEnableClientState(GL_VERTEX_ARRAY);
-      // glVertexPointer(3, GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(0));
-      // glEnableClientState(GL_NORMAL_ARRAY);
-      // glNormalPointer(GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(12));
-      // glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-      // glBindBuffer(GL_ARRAY_BUFFER, forest_quad_texcoords_VBO[i]);
-      // glTexCoordPointer(2, GL_FLOAT, sizeof(VBOTex), BUFFER_OFFSET(0));
-      // glBindTexture(GL_TEXTURE_2D, forest_quad_textures[i]);
-
-      // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, forest_quad_indices_VBO[i]);
-      // glDrawElements(GL_QUADS,
-      //                4,
-      //                GL_UNSIGNED_INT,
-      //                BUFFER_OFFSET(0));
-      
-      // glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-      // glDisableClientState(GL_NORMAL_ARRAY);
-      // glDisableClientState(GL_VERTEX_ARRAY);
+      meshes[s]->drawVBOsInstanced(mesh_instances[s][i], hemispheres[s]->getCenter(), i);
     }
-  } else {
-    glBindBuffer(GL_ARRAY_BUFFER, forest_quad_verts_VBO[0]);
+  }
+  glColor3f(1.0,1.0,1.0);
+
+  //  Far blocks, all in one draw call
+  if (num_cluster_quads > 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, cluster_verts_VBO);
     glEnableClientState(GL_VERTEX_ARRAY);
     glVertexPointer(3, GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(0));
     glEnableClientState(GL_NORMAL_ARRAY);
     glNormalPointer(GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(12));
-    glBindBuffer(GL_ARRAY_BUFFER, forest_quad_texcoords_VBO[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, cluster_texcoords_VBO);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
     glTexCoordPointer(2, GL_FLOAT, sizeof(VBOTex), BUFFER_OFFSET(0));
-    glBindTexture(GL_TEXTURE_2D, forest_quad_textures[0]);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, forest_quad_indices_VBO[0]);
-    glDrawElements(GL_QUADS,
-                   num_trees * 4,
-                   GL_UNSIGNED_INT,
-                   BUFFER_OFFSET(0));
-    
+    glBindTexture(GL_TEXTURE_2D, cluster_atlas);
+    glDrawArrays(GL_QUADS, 0, num_cluster_quads * 4);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
     glDisableClientState(GL_NORMAL_ARRAY);
     glDisableClientState(GL_VERTEX_ARRAY);
   }
+
+  //  Impostor trees, back to front, one draw call per run of a dither
+  //  level, all from the atlas
+  uploadTreeQuads();
+  uploadTreeTexcoords();
+  if (num_tree_quad_indices > 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, tree_quad_stream.getBuffer());
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(tree_quad_stream.getOffset()));
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(tree_quad_stream.getOffset() + 12));
+    glBindBuffer(GL_ARRAY_BUFFER, forest_quad_texcoords_VBO);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(VBOTex), BUFFER_OFFSET(0));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, forest_quad_indices_VBO);
+    glBindTexture(GL_TEXTURE_2D, view_atlas.getTexture());
+
+    for (unsigned int i = 0; i < tree_quad_runs.size(); ++i)
+    {
+      const TreeQuadRun &run = tree_quad_runs[i];
+      if (run.stipple >= 0)
+      {
+        glEnable(GL_POLYGON_STIPPLE);
+        glPolygonStipple(getFadeStipple(run.stipple, true));
+      }
+      glDrawElements(GL_QUADS,
+                     run.count * 4,
+                     GL_UNSIGNED_INT,
+                     BUFFER_OFFSET(sizeof(VBOQuad) * run.first));
+      if (run.stipple >= 0)
+      {
+        glDisable(GL_POLYGON_STIPPLE);
+      }
+    }
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    //  This copy of the quads can't be written again until these are drawn
+    tree_quad_stream.fence();
+  }
   glDisable( GL_TEXTURE_2D );
-  glDisable( GL_BLEND );
-  // glDisable( GL_SAMPLE_ALPHA_TO_COVERAGE );
-  // glDisable( GL_MULTISAMPLE_ARB );
+  endAlphaMode();
   glDisable( GL_DEPTH_TEST );
 }
 
+//  Set up the blending, coverage or alpha test for the trees
+void Forest::beginAlphaMode() {
+  switch (alpha_mode)
+  {
+    case ALPHA_BLEND:
+      glEnable( GL_BLEND );
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      break;
+    case ALPHA_COVERAGE:
+      //  Each sample is kept or dropped by the alpha, so the edges stay
+      //  soft with depth writes on and no sorting
+      glEnable( GL_MULTISAMPLE );
+      glEnable( GL_SAMPLE_ALPHA_TO_COVERAGE );
+      break;
+    case ALPHA_TEST:
+      glEnable( GL_ALPHA_TEST );
+      glAlphaFunc(GL_GREATER, 0.5f);
+      break;
+  }
+}
+
+void Forest::endAlphaMode() {
+  glDisable( GL_BLEND );
+  glDisable( GL_SAMPLE_ALPHA_TO_COVERAGE );
+  glDisable( GL_ALPHA_TEST );
+}
+
+void Forest::setCamera(Camera *c) {
+  camera = c;
+  setCameraPosition(camera->getPosition());
+}
+
 void Forest::setCameraPosition(Vec3f cameraPos) {
   camera_pos = cameraPos;
 }
 
+//  The quality controller scales the command line settings down from
+//  their full values.  The far-field clusters stay off if their FBO
+//  could not be made.
+void Forest::setQuality(const QualitySettings &q) {
+  mesh_distance = args->mesh_distance * q.mesh_scale;
+  mesh_budget = (int)ceil(args->mesh_budget * q.mesh_scale);
+  if (cluster_distance != FLT_MAX)
+    cluster_distance = args->cluster_distance * q.cluster_scale;
+  tree_density = q.tree_density;
+  view_atlas.setLodBias(q.impostor_bias);
+}
+
+//  The views baked so far, of all the species
+int Forest::numBakedViews() {
+  int baked = 0;
+  for (unsigned int s = 0; s < hemispheres.size(); ++s)
+  {
+    baked += hemispheres[s]->numBakedViews();
+  }
+  return baked;
+}
+
+//  Bake the views the trees wait for, a species at a time
+int Forest::bakePendingViews(int maxviews) {
+  int baked = 0;
+  for (unsigned int s = 0; s < hemispheres.size() && baked < maxviews; ++s)
+  {
+    if (hemispheres[s]->hasPendingViews())
+      baked += hemispheres[s]->bakePendingViews(maxviews - baked);
+  }
+  return baked;
+}
+
 void Forest::cameraMoved(Vec3f cameraPos) {
   setCameraPosition(cameraPos);
   setTreeQuads();
 }
 
+//  Which bucket of directions the camera is in, as seen from a tree
+int Forest::billboardBucket(const Vec3f &toCamera) const {
+  int around = (int)ceil(2 * M_PI / billboard_step);
+  int azimuth = (atan2(toCamera.z(), toCamera.x()) + M_PI) / billboard_step;
+  int elevation = (asin(std::min(1.0, std::max(-1.0, toCamera.y()))) + M_PI / 2) / billboard_step;
+  return elevation * around + std::min(azimuth, around - 1);
+}
+
 void Forest::setTreeQuads() {
-  int counter = 0;
-  for (unsigned int i = 0; i < tree_locations.size(); ++i)
+  //  Only the views wanted by this pass should be baked next
+  for (unsigned int s = 0; s < hemispheres.size(); ++s)
   {
-    for (unsigned int j = 0; j < tree_locations[i].size(); ++j)
-    {
-      Vec3f treeLoc = tree_locations[i][j];
-      //  Create a quad to draw the tree on
-      Vec3f center = treeLoc + Vec3f(0, tree_size/2, 0);
-      Vec3f toCamera = camera_pos - center;
-      toCamera.Normalize();
-      Vec3f horiz, vert;
-      Vec3f::Cross3(horiz, Vec3f(0,1,0), toCamera);
-      Vec3f::Cross3(vert, toCamera, horiz);
-      horiz.Normalize(); vert.Normalize();
-      forest_quad_verts[counter*4] = VBOTriVert(center - (tree_size/2)*horiz - (tree_size/2)*vert, toCamera);
-      forest_quad_verts[counter*4+1] = VBOTriVert(center - (tree_size/2)*horiz + (tree_size/2)*vert, toCamera);
-      forest_quad_verts[counter*4+2] = VBOTriVert(center + (tree_size/2)*horiz + (tree_size/2)*vert, toCamera);
-      forest_quad_verts[counter*4+3] = VBOTriVert(center + (tree_size/2)*horiz - (tree_size/2)*vert, toCamera);
-      forest_quad_textures[counter++] = hemisphere->getNearestView(tree_locations[i][j], camera_pos)->textureID();
-    }
+    hemispheres[s]->clearViewRequests();
   }
-  
-  glBindBuffer(GL_ARRAY_BUFFER,forest_quad_verts_VBO[0]);
-  if (tree_buffer_set)
+
+  //  Every tree still has to ask for its view, so the lazy views it is
+  //  waiting for get baked; the hemispheres aren't safe to share, so this
+  //  stays on this thread
+  for (unsigned int i = 0; i < tree_positions.size(); ++i)
   {
-    glBufferSubData(GL_ARRAY_BUFFER,
-                    0,
-                    sizeof(VBOTriVert) * num_trees * 4,
-                    forest_quad_verts);
+    int cell = hemispheres[tree_species[i]]->getNearestView(tree_positions[i], camera_pos)->getCell();
+    if (cell != tree_cell[i])
+    {
+      tree_cell[i] = cell;
+      tree_cells_changed = true;
+    }
   }
-  else
+
+  //  The quads are independent of each other, so they are built as
+  //  jobs, and 8 at a time within each job
+  std::atomic<bool> changed(false);
+  int numTrees = tree_positions.size();
+  GLOBAL_jobs.parallelFor(0, numTrees, 256, [&](int first, int last)
   {
-    tree_buffer_set = true;
-    glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(VBOTriVert) * num_trees * 4,
-                 forest_quad_verts,
-                 GL_STATIC_DRAW);
-  }
+    const Float8 half (tree_size/2);
+    for (int i = first; i < last; i += 8)
+    {
+      //  Create quads to draw the trees on, facing the camera
+      Vec3x8 center = Vec3x8::load(&quad_center_x[i], &quad_center_y[i], &quad_center_z[i]);
+      Vec3x8 toCamera = (Vec3x8(camera_pos) - center).Normalized();
+      Vec3x8 horiz = Vec3x8::Cross3(Vec3x8(Vec3f(0,1,0)), toCamera).Normalized();
+      Vec3x8 vert = Vec3x8::Cross3(toCamera, horiz).Normalized();
+      Vec3x8 corner[4] = {
+        center - horiz*half - vert*half,
+        center - horiz*half + vert*half,
+        center + horiz*half + vert*half,
+        center + horiz*half - vert*half
+      };
+      float dir[3][8], pos[4][3][8];
+      toCamera.store(dir[0], dir[1], dir[2]);
+      for (int c = 0; c < 4; ++c)
+        corner[c].store(pos[c][0], pos[c][1], pos[c][2]);
+
+      for (int k = 0; k < 8 && i + k < last; ++k)
+      {
+        //  Keep the quad while the camera is in the same direction
+        int bucket = billboardBucket(Vec3f(dir[0][k], dir[1][k], dir[2][k]));
+        if (bucket == tree_bucket[i+k])
+          continue;
+        tree_bucket[i+k] = bucket;
+        tree_quad_version[i+k] = tree_quads_version + 1;
+        changed = true;
+        for (int c = 0; c < 4; ++c)
+        {
+          VBOTriVert &v = forest_quad_verts[(i+k)*4 + c];
+          v.x = pos[c][0][k]; v.y = pos[c][1][k]; v.z = pos[c][2][k];
+          v.nx = dir[0][k]; v.ny = dir[1][k]; v.nz = dir[2][k];
+        }
+      }
+    }
+  });
+
+  //  The quads go to the GPU when they are next drawn
+  if (changed)
+    ++tree_quads_version;
+
+  updateLOD();
 
   // if (tree_buffer_set)
   // {
@@ -397,3 +814,444 @@ void Forest::setTreeQuads() {
   // }
   
 }
+
+//  Point the corners of every tree quad at the cell of its view
+void Forest::uploadTreeTexcoords() {
+  if (!tree_cells_changed)
+    return;
+  std::vector<VBOTex> texcoords (std::max(num_trees, 1) * 4);
+  for (int i = 0; i < num_trees; ++i)
+  {
+    float s0, t0, s1, t1;
+    view_atlas.getCellCoords(tree_cell[i], s0, t0, s1, t1);
+    texcoords[i*4] = VBOTex(s0, t0);
+    texcoords[i*4 + 1] = VBOTex(s0, t1);
+    texcoords[i*4 + 2] = VBOTex(s1, t1);
+    texcoords[i*4 + 3] = VBOTex(s1, t0);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, forest_quad_texcoords_VBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               sizeof(VBOTex) * texcoords.size(),
+               &texcoords[0],
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  tree_cells_changed = false;
+}
+
+//  Bring the latest copy of the tree quads in the stream buffer up to
+//  date.  Only the quads changed since that copy was written are sent,
+//  and nearby changes go together, since a small gap costs less than
+//  another copy.  If the GPU is still drawing from every copy, the old
+//  quads are drawn once more and the update waits for the next frame.
+void Forest::uploadTreeQuads() {
+  if (tree_quads_uploaded == tree_quads_version)
+    return;
+  int have;
+  VBOTriVert *dst = (VBOTriVert*)tree_quad_stream.beginWrite(have);
+  if (dst == NULL)
+    return;
+
+  if (have < 0)
+  {
+    memcpy(dst, forest_quad_verts, sizeof(VBOTriVert) * num_trees * 4);
+  }
+  else
+  {
+    int first = 0;
+    while (first < num_trees)
+    {
+      if (tree_quad_version[first] <= have)
+      {
+        ++first;
+        continue;
+      }
+      int last = first, next = first + 1;
+      while (next < num_trees && next - last <= billboard_merge_gap)
+      {
+        if (tree_quad_version[next] > have)
+          last = next;
+        ++next;
+      }
+      memcpy(&dst[first * 4], &forest_quad_verts[first * 4], sizeof(VBOTriVert) * (last - first + 1) * 4);
+      first = last + 1;
+    }
+  }
+  tree_quad_stream.endWrite(tree_quads_version);
+  tree_quads_uploaded = tree_quads_version;
+}
+
+//  Decide which trees are drawn with the full mesh this frame.
+//  The nearest trees within range get a mesh, up to the budget, and are
+//  dithered into their impostors as they approach the end of the range.
+void Forest::updateLOD() {
+  float fadeEnd = mesh_distance + fade_width;
+  float keepEnd = fadeEnd * (1 + mesh_hysteresis);
+
+  //  Trees in blocks drawn as a whole, or behind the terrain, do not
+  //  need anything else
+  updateOcclusion();
+  updateClusters();
+  std::vector<bool> clustered (num_trees, false);
+  for (int i = 0; i < num_trees; ++i)
+  {
+    clustered[i] = (block_is_cluster[tree_block[i]] && block_impostors[tree_block[i]].baked) || !tree_visible[i];
+  }
+
+  //  Gather the trees in range, with trees that already have a mesh
+  //  appearing a little closer than they are
+  std::vector<int> nearby;
+  tree_grid.querySphere(camera_pos, keepEnd, nearby);
+  std::vector<std::pair<float, int> > candidates;
+  for (unsigned int k = 0; k < nearby.size(); ++k)
+  {
+    int i = nearby[k];
+    if (clustered[i]) continue;
+    Vec3f center = tree_positions[i] + Vec3f(0, tree_size/2, 0);
+    float dist = (camera_pos - center).Length();
+    if (tree_is_mesh[i])
+    {
+      if (dist < keepEnd) candidates.push_back(std::make_pair(dist / (1 + mesh_hysteresis), i));
+    }
+    else if (dist < fadeEnd)
+    {
+      candidates.push_back(std::make_pair(dist, i));
+    }
+  }
+
+  //  Keep the nearest ones that fit in the budget
+  int budget = std::max(0, mesh_budget);
+  if ((int)candidates.size() > budget)
+  {
+    std::nth_element(candidates.begin(), candidates.begin() + budget, candidates.end());
+    candidates.resize(budget);
+  }
+
+  std::fill(tree_is_mesh.begin(), tree_is_mesh.end(), false);
+  mesh_instances.resize(meshes.size());
+  for (unsigned int s = 0; s < meshes.size(); ++s)
+  {
+    mesh_instances[s] = std::vector<std::vector<MeshInstance> > (meshes[s]->numLODs());
+  }
+  std::vector<int> fade_level (num_trees, 0);
+  for (unsigned int i = 0; i < candidates.size(); ++i)
+  {
+    int tree = candidates[i].second;
+    int species = tree_species[tree];
+    Mesh *mesh = meshes[species];
+    Vec3f center = tree_positions[tree] + Vec3f(0, tree_size/2, 0);
+    float dist = (camera_pos - center).Length();
+
+    //  16 is all mesh, 0 is all impostor
+    float t = (dist - mesh_distance) / fade_width;
+    t = std::min(1.0f, std::max(0.0f, t));
+    int level = (int)((1 - t) * 16 + 0.5f);
+    tree_is_mesh[tree] = true;
+    fade_level[tree] = level;
+    if (level == 0) continue;
+    int lod = std::min(mesh->numLODs() - 1, (int)(dist / fadeEnd * mesh->numLODs()));
+    float scale = tree_size / hemispheres[species]->getViewSize();
+    mesh_instances[species][lod].push_back(MeshInstance(center, scale, level == 16 ? NULL : getFadeStipple(level)));
+  }
+
+  //  Every tree that is not fully a mesh keeps (part of) its impostor,
+  //  unless the quality controller has thinned it out
+  std::vector<int> quads;
+  std::vector<float> depth (num_trees, 0);
+  for (int i = 0; i < num_trees; ++i)
+  {
+    if (clustered[i]) continue;
+    if (tree_is_mesh[i] && fade_level[i] == 16) continue;
+    if (!tree_is_mesh[i] && tree_thinning[i] >= tree_density) continue;
+    quads.push_back(i);
+    depth[i] = (camera_pos - tree_positions[i] - Vec3f(0, tree_size/2, 0)).Length();
+  }
+
+  //  The impostor of a fading tree is drawn with the inverse of its
+  //  mesh's stipple, so between them every pixel is drawn once
+  std::vector<int> stipple (num_trees, -1);
+  for (unsigned int i = 0; i < quads.size(); ++i)
+  {
+    int tree = quads[i];
+    if (tree_is_mesh[tree] && fade_level[tree] > 0) stipple[tree] = fade_level[tree];
+  }
+
+  //  Blending needs them back to front; the other modes do not care about
+  //  the order, so the quads are put together by dither level to make
+  //  fewer runs
+  bool reordered;
+  if (alpha_mode == ALPHA_BLEND)
+  {
+    reordered = tree_sorter.sort(quads, depth);
+    tree_quad_order = tree_sorter.getOrder();
+  }
+  else
+  {
+    std::vector<std::pair<int, int> > keys;
+    for (unsigned int i = 0; i < quads.size(); ++i)
+    {
+      int tree = quads[i];
+      keys.push_back(std::make_pair(stipple[tree], tree));
+    }
+    std::sort(keys.begin(), keys.end());
+    for (unsigned int i = 0; i < keys.size(); ++i)
+    {
+      quads[i] = keys[i].second;
+    }
+    reordered = (quads != tree_quad_order);
+    tree_quad_order.swap(quads);
+  }
+  const std::vector<int> &order = tree_quad_order;
+
+  //  Group neighbouring quads that share a dither level; every species
+  //  is in the same atlas, so that is all that splits them
+  tree_quad_runs.clear();
+  for (unsigned int i = 0; i < order.size(); ++i)
+  {
+    int tree = order[i];
+    if (tree_quad_runs.empty() || tree_quad_runs.back().stipple != stipple[tree])
+    {
+      tree_quad_runs.push_back(TreeQuadRun(i, 0, stipple[tree]));
+    }
+    tree_quad_runs.back().count++;
+  }
+
+  //  The index buffer only depends on the order
+  num_tree_quad_indices = order.size();
+  if (reordered && num_tree_quad_indices > 0)
+  {
+    std::vector<VBOQuad> indices;
+    indices.reserve(order.size());
+    for (unsigned int i = 0; i < order.size(); ++i)
+    {
+      int tree = order[i];
+      indices.push_back(VBOQuad(tree*4, tree*4 + 1, tree*4 + 2, tree*4 + 3));
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,forest_quad_indices_VBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(VBOQuad) * num_tree_quad_indices,
+                 &indices[0],
+                 GL_DYNAMIC_DRAW);
+  }
+}
+
+//  Find the blocks and trees that the terrain hides from the camera.
+//  Occlusion only depends on where the camera is, not where it looks,
+//  since anything off screen is kept, so this is only needed on moves.
+void Forest::updateOcclusion() {
+  std::fill(block_visible.begin(), block_visible.end(), true);
+  std::fill(tree_visible.begin(), tree_visible.end(), true);
+  if (!occlusion_culling || camera == NULL) return;
+
+  //  The matrices the next frame will be drawn with
+  GLfloat modelview[16], projection[16];
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  camera->glInit(args->width, args->height);
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+  camera->glPlaceCamera();
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+  glPopMatrix();
+  occlusion_culler.render(modelview, projection);
+
+  //  Only trees on screen can be hidden
+  float planes[6][4];
+  std::vector<int> onScreen;
+  SpatialGrid::frustumPlanes(modelview, projection, planes);
+  tree_grid.queryFrustum(planes, onScreen);
+
+  for (int i = 0; i < num_blocks; ++i)
+  {
+    if (tree_locations[i].empty()) continue;
+    block_visible[i] = !occlusion_culler.isOccluded(block_min[i], block_max[i]);
+  }
+  for (int i = 0; i < num_trees; ++i)
+  {
+    if (!block_visible[tree_block[i]]) tree_visible[i] = false;
+  }
+  for (unsigned int k = 0; k < onScreen.size(); ++k)
+  {
+    int i = onScreen[k];
+    if (!tree_visible[i]) continue;
+    Vec3f p = tree_positions[i];
+    Vec3f lo(p.x() - tree_size/2.0, p.y(), p.z() - tree_size/2.0);
+    Vec3f hi(p.x() + tree_size/2.0, p.y() + tree_size, p.z() + tree_size/2.0);
+    tree_visible[i] = !occlusion_culler.isOccluded(lo, hi);
+  }
+}
+
+//  Decide which blocks are far enough to draw as a single quad, render
+//  the ones that are missing or out of date, and build their quads
+void Forest::updateClusters() {
+  //  Rendering a block is cheap, but not free, so only do a few at a time.
+  //  Blocks that are not rendered yet draw their trees as usual.
+  const int maxBakes = 8;
+  float refresh = 1 - cos(cluster_refresh_angle);
+
+  std::vector<std::pair<float, int> > stale;
+  for (int i = 0; i < num_blocks; ++i)
+  {
+    BlockImpostor &bi = block_impostors[i];
+    if (bi.radius == 0) continue;
+    if (!block_visible[i]) continue;
+    Vec3f toCamera = camera_pos - bi.center;
+    float dist = toCamera.Length();
+    if (block_is_cluster[i])
+      block_is_cluster[i] = dist > cluster_distance * (1 - cluster_hysteresis);
+    else
+      block_is_cluster[i] = dist > cluster_distance;
+    if (!block_is_cluster[i]) continue;
+
+    //  Missing renders first, then by how far the view has turned, then
+    //  the ones made before the hemisphere had all of its views
+    toCamera.Normalize();
+    if (!bi.baked)
+      stale.push_back(std::make_pair(3.0f, i));
+    else if (1 - toCamera.Dot3(bi.baked_dir) > refresh)
+      stale.push_back(std::make_pair(1 - toCamera.Dot3(bi.baked_dir), i));
+    else if (bi.baked_views != numBakedViews())
+      stale.push_back(std::make_pair(0.0f, i));
+  }
+  std::sort(stale.rbegin(), stale.rend());
+  for (int i = 0; i < (int)stale.size() && i < maxBakes; ++i)
+  {
+    bakeBlockImpostor(stale[i].second);
+  }
+
+  //  One camera-facing quad per far block.  Its texture coordinates are
+  //  inset by half a texel, so filtering stays inside the block's cell.
+  std::vector<VBOTriVert> verts;
+  std::vector<VBOTex> texcoords;
+  float cell = 1.0f / cluster_atlas_cells;
+  float inset = 0.5f / (cluster_atlas_cells * cluster_cell_size);
+  for (int i = 0; i < num_blocks; ++i)
+  {
+    const BlockImpostor &bi = block_impostors[i];
+    if (!block_is_cluster[i] || !bi.baked || !block_visible[i]) continue;
+    Vec3f toCamera = camera_pos - bi.center;
+    toCamera.Normalize();
+    Vec3f horiz, vert;
+    Vec3f::Cross3(horiz, Vec3f(0,1,0), toCamera);
+    Vec3f::Cross3(vert, toCamera, horiz);
+    horiz.Normalize(); vert.Normalize();
+    verts.push_back(VBOTriVert(bi.center - bi.radius*horiz - bi.radius*vert, toCamera));
+    verts.push_back(VBOTriVert(bi.center - bi.radius*horiz + bi.radius*vert, toCamera));
+    verts.push_back(VBOTriVert(bi.center + bi.radius*horiz + bi.radius*vert, toCamera));
+    verts.push_back(VBOTriVert(bi.center + bi.radius*horiz - bi.radius*vert, toCamera));
+    float s0 = (i % cluster_atlas_cells) * cell + inset;
+    float t0 = (i / cluster_atlas_cells) * cell + inset;
+    float s1 = s0 + cell - 2*inset;
+    float t1 = t0 + cell - 2*inset;
+    texcoords.push_back(VBOTex(s0, t0));
+    texcoords.push_back(VBOTex(s0, t1));
+    texcoords.push_back(VBOTex(s1, t1));
+    texcoords.push_back(VBOTex(s1, t0));
+  }
+
+  num_cluster_quads = verts.size() / 4;
+  if (num_cluster_quads > 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, cluster_verts_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(VBOTriVert) * verts.size(), &verts[0], GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, cluster_texcoords_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(VBOTex) * texcoords.size(), &texcoords[0], GL_DYNAMIC_DRAW);
+  }
+}
+
+//  Render the impostors of every tree in a block, as seen from the
+//  current camera direction, into the block's cell of the atlas
+void Forest::bakeBlockImpostor(int block) {
+  BlockImpostor &bi = block_impostors[block];
+  Vec3f dir = camera_pos - bi.center;
+  dir.Normalize();
+  Vec3f eye = bi.center + dir * (bi.radius * 4);
+
+  //  Back to front, as seen from the eye.  The views are looked up before
+  //  binding anything, since a lazy hemisphere may render one on the spot.
+  //  The trees of the block are in a row from firstTree.
+  int firstTree = std::lower_bound(tree_block.begin(), tree_block.end(), block) - tree_block.begin();
+  std::vector<std::pair<float, int> > trees;
+  for (unsigned int k = 0; k < tree_locations[block].size(); ++k)
+  {
+    trees.push_back(std::make_pair(-(eye - tree_locations[block][k]).Length(), (int)k));
+  }
+  std::sort(trees.begin(), trees.end());
+  std::vector<int> cells;
+  for (unsigned int k = 0; k < trees.size(); ++k)
+  {
+    Hemisphere *hemisphere = hemispheres[tree_species[firstTree + trees[k].second]];
+    cells.push_back(hemisphere->getNearestView(tree_locations[block][trees[k].second], eye)->getCell());
+  }
+
+  //  Keep the state of the main view
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+               GL_SCISSOR_BIT | GL_VIEWPORT_BIT | GL_CURRENT_BIT);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+
+  OrthographicCamera camera(eye, bi.center, Vec3f(0,1,0), bi.radius * 2);
+  camera.glInit(cluster_cell_size, cluster_cell_size);
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+  camera.glPlaceCamera();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, cluster_FBO);
+  int x = (block % cluster_atlas_cells) * cluster_cell_size;
+  int y = (block / cluster_atlas_cells) * cluster_cell_size;
+  glViewport(x, y, cluster_cell_size, cluster_cell_size);
+  glScissor(x, y, cluster_cell_size, cluster_cell_size);
+  glEnable(GL_SCISSOR_TEST);
+  Vec3f bg = meshes[0]->background_color;
+  glClearColor(bg.r(), bg.g(), bg.b(), 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glDisable(GL_LIGHTING);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  //  Accumulate coverage in the alpha channel as well
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glColor3f(1.0,1.0,1.0);
+  glBindTexture(GL_TEXTURE_2D, view_atlas.getTexture());
+
+  for (unsigned int k = 0; k < trees.size(); ++k)
+  {
+    Vec3f location = tree_locations[block][trees[k].second];
+    Vec3f center = location + Vec3f(0, tree_size/2, 0);
+    Vec3f toEye = eye - center;
+    toEye.Normalize();
+    Vec3f horiz, vert;
+    Vec3f::Cross3(horiz, Vec3f(0,1,0), toEye);
+    Vec3f::Cross3(vert, toEye, horiz);
+    horiz.Normalize(); vert.Normalize();
+    Vec3f a = center - (tree_size/2)*horiz - (tree_size/2)*vert;
+    Vec3f b = center - (tree_size/2)*horiz + (tree_size/2)*vert;
+    Vec3f c = center + (tree_size/2)*horiz + (tree_size/2)*vert;
+    Vec3f d = center + (tree_size/2)*horiz - (tree_size/2)*vert;
+    float s0, t0, s1, t1;
+    view_atlas.getCellCoords(cells[k], s0, t0, s1, t1);
+    glBegin(GL_QUADS);
+    glTexCoord2f(s0,t0); glVertex3f(a.x(), a.y(), a.z());
+    glTexCoord2f(s0,t1); glVertex3f(b.x(), b.y(), b.z());
+    glTexCoord2f(s1,t1); glVertex3f(c.x(), c.y(), c.z());
+    glTexCoord2f(s1,t0); glVertex3f(d.x(), d.y(), d.z());
+    glEnd();
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  glPopAttrib();
+  HandleGLError("Leaving bakeBlockImpostor");
+
+  bi.baked_dir = dir;
+  bi.baked_views = numBakedViews();
+  bi.baked = true;
+}
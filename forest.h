@@ -2,20 +2,58 @@
 #define trees_foreset_h
 
 #include "argparser.h"
+#include "depthsort.h"
 #include "glCanvas.h"
+#include "impostoratlas.h"
+#include "occlusionculler.h"
+#include "qualitycontroller.h"
+#include "spatialgrid.h"
+#include "streambuffer.h"
 #include <vector>
 
+class Camera;
 class Hemisphere;
+class Mesh;
 
 struct VBOTriVert;
+struct MeshInstance;
+
+//  How the soft edges of the impostors are resolved
+enum AlphaMode { ALPHA_BLEND, ALPHA_COVERAGE, ALPHA_TEST };
+
+//  A stretch of the tree quad index buffer drawn in one call
+struct TreeQuadRun {
+  TreeQuadRun(int f, int c, int s) : first(f), count(c), stipple(s) {}
+  int first;
+  int count;
+  //  Dither level of the meshes the impostors fade into, -1 if solid;
+  //  the impostors get the pixels the mesh stipple leaves out
+  int stipple;
+};
+
+//  A render of all the trees in one terrain block, so that a distant
+//  block can be drawn as a single quad
+struct BlockImpostor {
+  BlockImpostor() : radius(0), baked_views(0), baked(false) {}
+  Vec3f center;
+  float radius;
+  //  Direction from the center that the trees were rendered from
+  Vec3f baked_dir;
+  //  The number of hemisphere views that existed at the time
+  int baked_views;
+  bool baked;
+};
 
 class Forest
 {
  public:
   // ========================
   // CONSTRUCTOR & DESTRUCTOR
-  Forest(ArgParser *a, Hemisphere* h);
+  //  One mesh and hemisphere of views per species of tree
+  Forest(ArgParser *a, const std::vector<Mesh*> &m, const std::vector<Hemisphere*> &h);
   ~Forest();
+  // make or load the terrain and trees; before initializeVBOs
+  void createWorld();
 
   // ===+=====
   // RENDERING
@@ -25,19 +63,61 @@ class Forest
   void cleanupVBOs();
   
   // CAMERA ADJUSTMENTS
+  void setCamera(Camera *c);
   void setCameraPosition(Vec3f cameraPos);
   void cameraMoved(Vec3f cameraPos);
   
   void setTreeQuads();
 
+  // WORLD SNAPSHOTS
+  void saveWorld(const std::string &filename);
+
+  //  Compute up to maxviews of the views the trees are waiting for,
+  //  returns how many were computed
+  int bakePendingViews(int maxviews);
+
+  // QUALITY
+  //  Scale back the distances and budgets given on the command line;
+  //  takes effect at the next cameraMoved
+  void setQuality(const QualitySettings &q);
+
  private:
   // helper functions
+  int billboardBucket(const Vec3f &toCamera) const;
+  void uploadTreeQuads();
+  void generateWorld();
+  bool loadWorld(const std::string &filename);
+  void setupSpecies();
+  int numBakedViews();
+  void uploadTreeTexcoords();
+  void updateOcclusion();
+  void updateLOD();
+  void beginAlphaMode();
+  void endAlphaMode();
+  void updateClusters();
+  void bakeBlockImpostor(int block);
   
   // ==============
   // REPRESENTATION
   ArgParser *args;
 
-  Hemisphere *hemisphere;
+  //  The species of tree, and which one each tree is
+  std::vector<Mesh*> meshes;
+  std::vector<Hemisphere*> hemispheres;
+  std::vector<int> tree_species;
+  std::vector<int> species_trees;
+
+  //  The views of every species, which the impostors are drawn from.
+  //  Each tree keeps the cell of the view it is drawn with, and the
+  //  texture coordinates go up again when any of them change.
+  ImpostorAtlas view_atlas;
+  std::vector<int> tree_cell;
+  bool tree_cells_changed;
+
+  //  Each tree has a fixed rank in [0,1), and only trees ranked below
+  //  tree_density are drawn while they are impostors
+  float tree_density;
+  std::vector<float> tree_thinning;
 
   float area;
   int num_blocks;
@@ -45,19 +125,103 @@ class Forest
   int num_trees;
   int tree_size;
   bool tree_buffer_set;
+  //  True once setupVBOs has moved the trees into world space
+  bool tree_world_space;
 
+  Camera *camera;
   Vec3f camera_pos;
   Vec3f aT, bT, cT, dT;
 
+  //  Ground vertex heights, at the block corners
+  std::vector<std::vector<float> > terrain_heights;
+
+  //  The view each tree of a loaded world was drawn with, if any
+  std::vector<int> saved_view_level;
+  std::vector<int> saved_view_point;
+
   //  Hold the world-space coordinates of each tree
   std::vector<std::vector<Vec3f> > tree_locations;
+
+  //  The same coordinates in one list, in the order of the tree quads
+  std::vector<Vec3f> tree_positions;
+  //  The centers of the tree quads as floats, one array per axis and
+  //  padded to a multiple of 8, for building the quads 8 at a time
+  std::vector<float> quad_center_x, quad_center_y, quad_center_z;
+
+  //  Index of the tree centers, for finding the trees near the camera
+  //  or on screen without going through all of them
+  SpatialGrid tree_grid;
+
+  //  Level of detail: trees closer than mesh_distance are drawn with the
+  //  full mesh, and cross-fade into impostors over the next fade_width units.
+  //  At most mesh_budget trees get a mesh, nearest first, and trees that
+  //  already have one keep it a little longer (mesh_hysteresis) to avoid
+  //  trees trading places every frame at the edge of the budget.
+  //  The mesh range is split evenly between the mesh levels of detail.
+  float mesh_distance;
+  float fade_width;
+  float mesh_hysteresis;
+  int mesh_budget;
+  std::vector<bool> tree_is_mesh;
+  //  By species, then by mesh level of detail
+  std::vector<std::vector<std::vector<MeshInstance> > > mesh_instances;
+
+  //  Far field: blocks farther than cluster_distance are drawn as one quad
+  //  with a render of all their trees, kept in one atlas texture with a
+  //  cell per block.  A block is rendered again once the direction to the
+  //  camera has turned by more than cluster_refresh_angle.
+  float cluster_distance;
+  float cluster_hysteresis;
+  float cluster_refresh_angle;
+  int cluster_cell_size;
+  int cluster_atlas_cells;
+  std::vector<int> tree_block;
+  std::vector<BlockImpostor> block_impostors;
+  std::vector<bool> block_is_cluster;
+  int num_cluster_quads;
+  GLuint cluster_atlas;
+  GLuint cluster_FBO;
+  GLuint cluster_depth_RB;
+  GLuint cluster_verts_VBO;
+  GLuint cluster_texcoords_VBO;
+
+  //  Trees and blocks hidden behind the terrain are not drawn at all.
+  //  Block bounds are tested first, then the trees of the visible blocks.
+  bool occlusion_culling;
+  OcclusionCuller occlusion_culler;
+  std::vector<Vec3f> block_min;
+  std::vector<Vec3f> block_max;
+  std::vector<bool> block_visible;
+  std::vector<bool> tree_visible;
+
+  //  The impostor quads to draw, in runs that share a dither level.
+  //  When blending they go back to front, and the order is kept from one
+  //  update to the next; otherwise they are simply grouped by level.
+  AlphaMode alpha_mode;
+  DepthSorter tree_sorter;
+  std::vector<int> tree_quad_order;
+  std::vector<TreeQuadRun> tree_quad_runs;
+  int num_tree_quad_indices;
   
   VBOTriVert* forest_quad_verts;
+
+  //  Billboards are only turned again once the direction to the camera
+  //  moves into another bucket, billboard_step radians on a side, and
+  //  only the quads that changed are uploaded, in as few ranges as
+  //  possible.  Ranges closer than billboard_merge_gap trees are merged.
+  //  Every change bumps tree_quads_version, and each tree keeps the
+  //  version its quad last changed in, so each copy in the stream buffer
+  //  can be brought up to date on its own.
+  float billboard_step;
+  int billboard_merge_gap;
+  std::vector<int> tree_bucket;
+  std::vector<int> tree_quad_version;
+  int tree_quads_version;
+  int tree_quads_uploaded;
+  StreamBuffer tree_quad_stream;
   
-  std::vector<GLuint> forest_quad_verts_VBO;
-  std::vector<GLuint> forest_quad_indices_VBO;
-  std::vector<GLuint> forest_quad_texcoords_VBO;
-  std::vector<GLuint> forest_quad_textures;
+  GLuint forest_quad_indices_VBO;
+  GLuint forest_quad_texcoords_VBO;
 
   //Ground representation
   GLuint gnd_mesh_tri_verts_VBO;
@@ -2,21 +2,26 @@
 #include "argparser.h"
 #include "camera.h"
 #include "mesh.h"
-#include "hemisphere.h"
 #include "forest.h"
+#include "jobsystem.h"
+#include "qualitycontroller.h"
+#include "headless.h"
 
 #include "view.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <fstream>
 
 // ========================================================
 // static variables of GLCanvas class
 
 ArgParser* GLCanvas::args = NULL;
-Mesh* GLCanvas::mesh = NULL;
+std::vector<Mesh*> GLCanvas::meshes;
 Camera* GLCanvas::camera = NULL;
-Hemisphere* GLCanvas::hemisphere = NULL;
 Forest* GLCanvas::forest = NULL;
+QualityController GLCanvas::quality;
 
 // State of the mouse cursor
 int GLCanvas::mouseButton = 0;
@@ -39,11 +44,11 @@ bool GLCanvas::key_d = false;
 // by calling 'exit(0)'
 // ========================================================
 
-void GLCanvas::initialize(ArgParser *_args, Mesh* _mesh, Hemisphere* _hemisphere, Forest* _forest) {
+void GLCanvas::initialize(ArgParser *_args, const std::vector<Mesh*> &_meshes, Forest* _forest,
+                          TaskGroup *mesh_loading, TaskGroup *world_loading) {
 
   args = _args;
-  mesh = _mesh;
-  hemisphere = _hemisphere;
+  meshes = _meshes;
   forest = _forest;
 
   // Vec3f camera_position = Vec3f(0,0,5);
@@ -56,7 +61,10 @@ void GLCanvas::initialize(ArgParser *_args, Mesh* _mesh, Hemisphere* _hemisphere
   // setup glut stuff
   glutInitWindowSize(args->width, args->height);
   glutInitWindowPosition(100,100);
-  glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGB);
+  if (args->alpha_mode == "coverage")
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGB | GLUT_MULTISAMPLE);
+  else
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGB);
   glutCreateWindow("OpenGL Viewer");
   HandleGLError("in glcanvas initialize");
 
@@ -67,6 +75,31 @@ void GLCanvas::initialize(ArgParser *_args, Mesh* _mesh, Hemisphere* _hemisphere
       exit(1);
   }
 #endif
+  setupGL();
+
+  // Initialize callback functions
+  glutMouseFunc(mouse);
+  glutMotionFunc(motion);
+  glutDisplayFunc(display);
+  glutReshapeFunc(reshape);
+  glutKeyboardFunc(keyboard);
+  glutKeyboardUpFunc(keyboardUp);
+  glutIdleFunc(idle);
+
+  HandleGLError("finished glcanvas initialize");
+
+  setupScene(mesh_loading, world_loading);
+
+  // Enter the main rendering loop
+  glutMainLoop();
+}
+
+
+// ========================================================
+// The GL state everything is drawn with
+// ========================================================
+
+void GLCanvas::setupGL() {
   // basic rendering 
   glEnable(GL_LIGHTING);
   glEnable(GL_DEPTH_TEST);
@@ -80,28 +113,110 @@ void GLCanvas::initialize(ArgParser *_args, Mesh* _mesh, Hemisphere* _hemisphere
   glCullFace(GL_BACK);
   glDisable(GL_CULL_FACE);
   glEnable(GL_TEXTURE_2D);
+}
 
-  // Initialize callback functions
-  glutMouseFunc(mouse);
-  glutMotionFunc(motion);
-  glutDisplayFunc(display);
-  glutReshapeFunc(reshape);
-  glutKeyboardFunc(keyboard);
-  glutKeyboardUpFunc(keyboardUp);
-  glutIdleFunc(idle);
-
-  HandleGLError("finished glcanvas initialize");
+// ========================================================
+// Upload the meshes and the forest, once they are loaded
+// ========================================================
 
-  mesh->initializeVBOs();
-  hemisphere->setup();
+void GLCanvas::setupScene(TaskGroup *mesh_loading, TaskGroup *world_loading) {
+  // only the uploads have to wait, and the world can still be made
+  // while the meshes go up.  The hemispheres are baked by the forest,
+  // which shares the views out between the species by how many trees
+  // there are of each.
+  if (mesh_loading != NULL) mesh_loading->wait();
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    meshes[i]->initializeVBOs();
+  }
 
-  forest->setCameraPosition(camera->getPosition());
+  camera->glInit(args->width, args->height);
+  forest->setCamera(camera);
+  if (world_loading != NULL) world_loading->wait();
   forest->initializeVBOs();
+  quality.initialize(args->target_frame_ms);
 
   HandleGLError("finished mesh, hemisphere, and forest initialization");
+}
 
-  // Enter the main rendering loop
-  glutMainLoop();
+// ========================================================
+// Render the frames of a camera path without a window, see
+// ArgParser::headless.  Returns the exit status.
+// ========================================================
+
+int GLCanvas::runHeadless(ArgParser *_args, const std::vector<Mesh*> &_meshes, Forest* _forest,
+                          TaskGroup *mesh_loading, TaskGroup *world_loading) {
+
+  args = _args;
+  meshes = _meshes;
+  forest = _forest;
+
+  std::vector<PerspectiveCamera> path;
+  bool ok = LoadCameraPath(args->camera_path, path) &&
+            HeadlessCreateContext(args->width, args->height, args->alpha_mode == "coverage" ? 4 : 0);
+  if (!ok) {
+    // the job system can't stop with the loading still queued
+    if (mesh_loading != NULL) mesh_loading->wait();
+    if (world_loading != NULL) world_loading->wait();
+    return 1;
+  }
+  camera = new PerspectiveCamera(path[0]);
+  setupGL();
+  setupScene(mesh_loading, world_loading);
+  glViewport(0, 0, args->width, args->height);
+
+  std::ofstream timings;
+  if (args->timings != "") {
+    timings.open(args->timings.c_str());
+    if (!timings) std::cerr << "Cannot write the timings to " << args->timings << std::endl;
+    timings << "frame,ms,cpu_ms,gpu_ms,quality_level\n";
+  }
+
+  int frames = (args->frames > 0) ? args->frames : path.size();
+  std::vector<float> frame_ms;
+  for (int f = 0; f < frames; f++) {
+    *(PerspectiveCamera*)camera = path[f % path.size()];
+
+    // a frame is the update for the camera and the drawing, up to the
+    // GPU being done with it
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    cameraMoved();
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // lazy views are all baked before drawing, and not timed, so the
+    // frames only depend on the path and not on how fast that went
+    while (forest->bakePendingViews(64) > 0) {
+      forest->cameraMoved(camera->getPosition());
+    }
+
+    start = std::chrono::steady_clock::now();
+    drawFrame();
+    glFinish();
+    ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    quality.readGpuTimes();
+    frame_ms.push_back(ms);
+    if (timings.is_open()) {
+      timings << f << "," << ms << "," << quality.getCpuMs() << ","
+              << quality.getGpuMs() << "," << quality.getLevel() << "\n";
+    }
+
+    if (args->dump_frames != "") {
+      char number[16];
+      snprintf(number, sizeof(number), "%04d.ppm", f);
+      SaveFramebuffer(args->dump_frames + number, args->width, args->height);
+    }
+  }
+
+  std::sort(frame_ms.begin(), frame_ms.end());
+  float total = 0;
+  for (unsigned int i = 0; i < frame_ms.size(); i++) total += frame_ms[i];
+  std::cout << "Rendered " << frames << " frames at " << args->width << "x" << args->height
+            << ": mean " << total / frames << " ms, median " << frame_ms[frames / 2]
+            << " ms, 95th percentile " << frame_ms[std::min(frames - 1, (int)(frames * 0.95))]
+            << " ms, max " << frame_ms.back() << " ms" << std::endl;
+
+  quality.cleanup();
+  HeadlessDestroyContext();
+  return 0;
 }
 
 
@@ -142,8 +257,28 @@ void GLCanvas::InitLight() {
 void GLCanvas::display(void) {
   glDrawBuffer(GL_BACK);
 
-  mesh->background_color = Vec3f(1.0, 1.0, 1.0);
-  Vec3f bg = mesh->background_color;
+  // draw the next frame as well if the quality changed
+  if (drawFrame())
+    glutPostRedisplay();
+   
+  // Swap the back buffer with the front buffer to display
+  // the scene
+  glutSwapBuffers();
+}
+
+// ========================================================
+// Draw the trees and the ground into the current draw buffer.
+// Returns true if the quality changed, and the next frame
+// should be drawn too
+// ========================================================
+
+bool GLCanvas::drawFrame() {
+  quality.beginFrame();
+
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    meshes[i]->background_color = Vec3f(1.0, 1.0, 1.0);
+  }
+  Vec3f bg = meshes[0]->background_color;
   // Clear the display buffer, set it to the background color
   glClearColor(bg.r(),bg.g(),bg.b(),0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -160,10 +295,24 @@ void GLCanvas::display(void) {
 
   glGetError();
   HandleGLError(); 
-   
-  // Swap the back buffer with the front buffer to display
-  // the scene
-  glutSwapBuffers();
+
+  // Measure the frame before the swap, which may wait for the display
+  if (!quality.endFrame())
+    return false;
+  forest->setQuality(quality.getSettings());
+  cameraMoved();
+  return true;
+}
+
+// ========================================================
+// Update the forest for the camera; this is part of what the
+// next frame costs
+// ========================================================
+
+void GLCanvas::cameraMoved() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  forest->cameraMoved(camera->getPosition());
+  quality.addCpuTime(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
 }
 
 // ========================================================
@@ -208,6 +357,7 @@ void GLCanvas::motion(int x, int y) {
     camera->rotateCamera(0.005*(mouseX-x), 0.005*(mouseY-y));
     mouseX = x;
     mouseY = y;
+    cameraMoved();
   }
   // Middle button = translation
   // (move camera perpendicular to the direction vector)
@@ -215,7 +365,7 @@ void GLCanvas::motion(int x, int y) {
     camera->truckCamera((mouseX-x)*0.5, (y-mouseY)*0.5);
     mouseX = x;
     mouseY = y;
-    forest->cameraMoved(camera->getPosition());
+    cameraMoved();
   }
   // Right button = dolly or zoom
   // (move camera along the direction vector)
@@ -227,7 +377,7 @@ void GLCanvas::motion(int x, int y) {
     }
     mouseX = x;
     mouseY = y;
-    forest->cameraMoved(camera->getPosition());
+    cameraMoved();
   }
 
 
@@ -256,6 +406,16 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
   case 'd': case 'D':
     key_d = true;
     break;
+  case 'o': case 'O':
+    forest->saveWorld(args->save_world);
+    break;
+  case 'p': case 'P': {
+    // one more frame for the headless mode to render
+    std::ofstream ostr(args->camera_path.c_str(), std::ios::app);
+    ostr << *camera;
+    std::cout << "Added the camera to " << args->camera_path << std::endl;
+    break;
+  }
   default:
     printf("UNKNOWN KEYBOARD INPUT  '%c'\n", key);
   }
@@ -278,6 +438,9 @@ void GLCanvas::keyboardUp(unsigned char key, int x, int y) {
   case 'd': case 'D':
     key_d = false;
     break;
+  case 'o': case 'O':
+  case 'p': case 'P':
+    break;
   default:
     printf("UNKNOWN KEYBOARD INPUT  '%c'\n", key);
   }
@@ -303,7 +466,15 @@ void GLCanvas::idle() {
     }
   if (key_w || key_a || key_s || key_d)
     {
-      forest->cameraMoved(camera->getPosition());
+      cameraMoved();
+      glutPostRedisplay();
+    }
+
+  //Compute one of the views the trees are waiting for, then let the
+  //trees pick it up in place of the stand-in they have been using
+  if (forest->bakePendingViews(1) > 0)
+    {
+      cameraMoved();
       glutPostRedisplay();
     }
   
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 // Included files for OpenGL Rendering
 #ifdef __APPLE__
@@ -29,8 +30,9 @@
 class ArgParser;
 class Mesh;
 class Camera;
-class Hemisphere;
 class Forest;
+class TaskGroup;
+class QualityController;
 
 // ====================================================================
 // NOTE:  All the methods and variables of this class are static
@@ -43,17 +45,28 @@ public:
   // Set up the canvas and enter the rendering loop
   // Note that this function will not return but can be
   // terminated by calling 'exit(0)'
-  static void initialize(ArgParser *_args, Mesh* _mesh, Hemisphere* _hemisphere, Forest* _forest);
+  // The meshes and the forest may still be loading in the given task
+  // groups, which are waited for just before each is uploaded
+  static void initialize(ArgParser *_args, const std::vector<Mesh*> &_meshes, Forest* _forest,
+                         TaskGroup *mesh_loading = NULL, TaskGroup *world_loading = NULL);
+  // The same without a window: render the frames of the camera path
+  // offscreen, report their times and return the exit status
+  static int runHeadless(ArgParser *_args, const std::vector<Mesh*> &_meshes, Forest* _forest,
+                         TaskGroup *mesh_loading = NULL, TaskGroup *world_loading = NULL);
 private:
 
+  static void setupGL();
+  static void setupScene(TaskGroup *mesh_loading, TaskGroup *world_loading);
   static void InitLight();
+  static bool drawFrame();
+  static void cameraMoved();
 
   // various static variables
   static ArgParser *args;
-  static Mesh* mesh;
+  static std::vector<Mesh*> meshes;
   static Camera *camera;
-  static Hemisphere* hemisphere;
   static Forest* forest;
+  static QualityController quality;
 
   // state of the mouse cursor
   static int mouseButton;
@@ -18,14 +18,16 @@
 class Edge;
 #include "triangle.h"
 #include "vertex.h"
+#include "edgehashmap.h"
 
 #define LARGE_PRIME_A 10007
 #define LARGE_PRIME_B 11003
 
 
 // ===================================================================================
-// DIRECTED EDGES are stored in a hash table using a simple hash
-// function based on the indices of the start and end vertices
+// ORDERED VERTEX PAIRS are hashed with a simple hash function based on
+// the indices of the two vertices (the directed edges of a mesh have a
+// table of their own, EdgeHashMap)
 // ===================================================================================
 
 inline unsigned int ordered_two_int_hash(unsigned int a, unsigned int b) {
@@ -106,22 +108,21 @@ struct sameid {
 // NOTE: You may need to adjust these depending on your installation
 #ifdef __APPLE__
 typedef __gnu_cxx::hash_map<std::pair<Vertex*,Vertex*>,Vertex*,unorderedvertexpairhash,unorderedsamevertexpair> vphashtype;
-typedef __gnu_cxx::hash_map<std::pair<Vertex*,Vertex*>,Edge*,orderedvertexpairhash,orderedsamevertexpair> edgeshashtype;
 typedef __gnu_cxx::hash_map<unsigned int,Triangle*,idhash,sameid> triangleshashtype;
 #elif defined(_WIN32)
 typedef std::unordered_map<std::pair<Vertex*,Vertex*>,Vertex*,unorderedvertexpairhash,unorderedsamevertexpair> vphashtype;
-typedef std::unordered_map<std::pair<Vertex*,Vertex*>,Edge*,orderedvertexpairhash,orderedsamevertexpair> edgeshashtype;
 typedef std::unordered_map<unsigned int,Triangle*,idhash,sameid> triangleshashtype;
 #elif defined(__linux__)
 typedef std::unordered_map<std::pair<Vertex*,Vertex*>,Vertex*,unorderedvertexpairhash,unorderedsamevertexpair> vphashtype;
-typedef std::unordered_map<std::pair<Vertex*,Vertex*>,Edge*,orderedvertexpairhash,orderedsamevertexpair> edgeshashtype;
 typedef std::unordered_map<unsigned int,Triangle*,idhash,sameid> triangleshashtype;
 #elif defined(__FreeBSD__)
 typedef __gnu_cxx::hash_map<std::pair<Vertex*,Vertex*>,Vertex*,unorderedvertexpairhash,unorderedsamevertexpair> vphashtype;
-typedef __gnu_cxx::hash_map<std::pair<Vertex*,Vertex*>,Edge*,orderedvertexpairhash,orderedsamevertexpair> edgeshashtype;
 typedef __gnu_cxx::hash_map<unsigned int,Triangle*,idhash,sameid> triangleshashtype;
 #else
 #endif
 
+// directed edges have a table of their own, see edgehashmap.h
+typedef EdgeHashMap edgeshashtype;
+
 
 #endif // _HASH_H_
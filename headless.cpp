@@ -0,0 +1,154 @@
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "headless.h"
+#include "glCanvas.h"
+#include "image.h"
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// =======================================================================
+// CONTEXT
+// =======================================================================
+
+#ifdef USE_EGL
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLSurface egl_surface = EGL_NO_SURFACE;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+
+// the surfaceless platform if the EGL library knows it, else whatever
+// the default display is
+static EGLDisplay openDisplay() {
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL &&
+      getPlatformDisplay != NULL) {
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY) return display;
+  }
+#endif
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool HeadlessCreateContext(int width, int height, int samples) {
+  assert (egl_display == EGL_NO_DISPLAY);
+  egl_display = openDisplay();
+  EGLint major, minor;
+  if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+    std::cerr << "Cannot open an EGL display\n";
+    egl_display = EGL_NO_DISPLAY;
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cerr << "EGL has no desktop OpenGL\n";
+    HeadlessDestroyContext();
+    return false;
+  }
+
+  EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_SAMPLE_BUFFERS, samples > 0 ? 1 : 0,
+    EGL_SAMPLES, samples,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint num_configs = 0;
+  if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+    std::cerr << "No EGL config for a " << width << "x" << height << " pbuffer\n";
+    HeadlessDestroyContext();
+    return false;
+  }
+  EGLint pbuffer_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+  egl_surface = eglCreatePbufferSurface(egl_display, config, pbuffer_attribs);
+  egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, NULL);
+  if (egl_surface == EGL_NO_SURFACE || egl_context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+    std::cerr << "Cannot make an EGL context current (error 0x" << std::hex << eglGetError() << std::dec << ")\n";
+    HeadlessDestroyContext();
+    return false;
+  }
+  std::cout << "Headless: EGL " << major << "." << minor << ", "
+            << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION) << "\n";
+  return true;
+}
+
+void HeadlessDestroyContext() {
+  if (egl_display == EGL_NO_DISPLAY) return;
+  eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
+  if (egl_surface != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surface);
+  eglTerminate(egl_display);
+  egl_display = EGL_NO_DISPLAY;
+  egl_surface = EGL_NO_SURFACE;
+  egl_context = EGL_NO_CONTEXT;
+}
+
+#else
+
+bool HeadlessCreateContext(int /*width*/, int /*height*/, int /*samples*/) {
+  std::cerr << "This build has no headless rendering, it needs EGL\n";
+  return false;
+}
+
+void HeadlessDestroyContext() {
+}
+
+#endif
+
+// =======================================================================
+// CAMERA PATHS & FRAMES
+// =======================================================================
+
+bool LoadCameraPath(const std::string &filename, std::vector<PerspectiveCamera> &path) {
+  std::ifstream istr(filename.c_str());
+  if (!istr) {
+    std::cerr << "Cannot open the camera path " << filename << std::endl;
+    return false;
+  }
+  path.clear();
+  std::string token;
+  while (istr >> token) {
+    if (token != "PerspectiveCamera") {
+      std::cerr << "Expected a PerspectiveCamera in " << filename
+                << " after " << path.size() << " cameras, not '" << token << "'\n";
+      return false;
+    }
+    PerspectiveCamera camera;
+    istr >> camera;
+    path.push_back(camera);
+  }
+  if (path.empty()) {
+    std::cerr << "No cameras in " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SaveFramebuffer(const std::string &filename, int width, int height) {
+  std::vector<unsigned char> pixels(width * height * 3);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+  // GL rows go bottom up, and Image::Save flips them back
+  Image image;
+  image.Allocate(width, height);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const unsigned char *p = &pixels[3*(y*width + x)];
+      image.SetPixel(x, y, Color(p[0], p[1], p[2]));
+    }
+  }
+  return image.Save(filename);
+}
+
+// =======================================================================
@@ -0,0 +1,35 @@
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+#include <string>
+#include <vector>
+
+#include "camera.h"
+
+// ===================================================================
+// Rendering without a window, for benchmarks and regression runs on
+// machines with no display.
+//
+// The GL context comes from EGL, on Mesa's surfaceless platform when
+// there is one (so llvmpipe works with no GPU at all), and draws into
+// a pbuffer the size of the window it stands in for.  The pbuffer is
+// the default framebuffer of the context, so the code that binds
+// framebuffer 0 again after rendering to a texture works as it is.
+// Built without EGL (see USE_EGL in CMakeLists.txt) there is no
+// headless context to be had.
+
+// make a context with a width x height pbuffer (multisampled if
+// samples > 0) current on this thread; false if it can't be done
+bool HeadlessCreateContext(int width, int height, int samples);
+void HeadlessDestroyContext();
+
+// a camera path is the cameras of the frames, one after the other,
+// in the format of operator<< for PerspectiveCamera
+bool LoadCameraPath(const std::string &filename, std::vector<PerspectiveCamera> &path);
+
+// read back the color buffer and write it to a .ppm
+bool SaveFramebuffer(const std::string &filename, int width, int height);
+
+// ===================================================================
+
+#endif
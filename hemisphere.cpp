@@ -15,20 +15,28 @@
 
 #include "hemisphere.h"
 
+#include <algorithm>
+
 //Default constructor
 Hemisphere::Hemisphere() :
   levels(0),
-  mesh(NULL)
+  mesh(NULL),
+  atlas(NULL),
+  lazy(false),
+  baked(0)
 {
   //Why would you use this?
   view.resize(0);
 }
 
 //Regular constructor
-Hemisphere::Hemisphere(Mesh* inmesh, int inlevels, int inpoints) :
+Hemisphere::Hemisphere(Mesh* inmesh, int inlevels, int inpoints, bool inlazy) :
   levels(inlevels),
   basepoints(inpoints),
-  mesh(inmesh)
+  mesh(inmesh),
+  atlas(NULL),
+  lazy(inlazy),
+  baked(0)
 {
   //Much better
   view.resize(inlevels);
@@ -66,35 +74,169 @@ int Hemisphere::numViews()
   return sum;
 }
 
+//Takes away levels and points around so that there are at most
+//maxviews views, with about as many points around for every level up
+//as before.  There are never fewer than 2 levels of 4 points.
+void Hemisphere::limitViews(int maxviews)
+{
+  if (levels*basepoints > maxviews)
+    {
+      float shrink = std::sqrt(float(maxviews)/(levels*basepoints));
+      levels = std::max(2, int(levels*shrink));
+      basepoints = std::max(4, std::min(basepoints, maxviews/levels));
+    }
+  view.resize(levels);
+}
+
 //Initializes the data structure.
-//Will not actually compute any views, but will get ready to do so.
+//Unless the hemisphere is lazy, this also computes every view.
 //This must be called before the object can really be used.
 void Hemisphere::setup()
 {
   //First, compute the bounds of the mesh
   computeBounds();
 
+  //Make room for the views and their bookkeeping
+  for (int i = 0; i < levels; i++)
+    {
+      view[i].resize(basepoints, NULL);
+    }
+  requests.assign(levels, std::vector<int>(basepoints, 0));
+  hints.assign(levels, std::vector<int>(basepoints, 0));
+  substitute.assign(levels, std::vector<View*>(basepoints, (View*)NULL));
+  substituteDist.assign(levels, std::vector<float>(basepoints, FLT_MAX));
+
+  //Lazy hemispheres compute views on demand through bakePendingViews
+  if (lazy)
+    {
+      std::cout << "Lazy view calculation, " << numViews() << " views deferred\n";
+      return;
+    }
+
   //Create the views
   //Cycle over each level
   std::cout << "Before view calculation\n";
   for (int i = 0; i < levels; i++)
     {
-      //Find the number of points at this level
-      float angY = (HEMISPHERE_PI/2)*(float(i)/float(levels-1));
-      if (i == levels-1) angY -= 0.0001;
-      view[i].resize(basepoints, NULL);
-
       //Compute the views
       for (unsigned int j = 0; j < view[i].size(); j++)
 	{
-	  float angXZ = (HEMISPHERE_PI*2)*(float(j)/float(view[i].size()));
-	  view[i][j] = new View(mesh);
-	  view[i][j]->computeView(angXZ, angY, 100, min, max);
+	  bakeView(i, j);
 	}
     }
   std::cout << "After view calculation\n";
 }
 
+//Returns the vertical angle of the points at level i
+float Hemisphere::getYAngFromPoint(int i)
+{
+  float angY = (HEMISPHERE_PI/2)*(float(i)/float(levels-1));
+  if (i == levels-1) angY -= 0.0001;
+  return angY;
+}
+
+//Returns the unit vector from the center toward the view at i, j
+Vec3f Hemisphere::getViewDirection(int i, int j)
+{
+  float angXZ = getXZAngFromPoint(i, j);
+  float angY = getYAngFromPoint(i);
+  return Vec3f(std::cos(angXZ)*std::cos(angY), std::sin(angY),
+	       std::sin(angXZ)*std::cos(angY));
+}
+
+//Computes the view at level i, point j, and lets it stand in
+//for any missing views that it is now the closest to
+void Hemisphere::bakeView(int i, int j)
+{
+  assert(view[i][j] == NULL);
+  view[i][j] = new View(mesh, atlas);
+  view[i][j]->computeView(getXZAngFromPoint(i, j), getYAngFromPoint(i), 100, min, max);
+  baked++;
+
+  //Nobody needs to wait for this view anymore
+  requests[i][j] = 0;
+  hints[i][j] = 0;
+  substitute[i][j] = view[i][j];
+  substituteDist[i][j] = 0;
+
+  //Update the stand-ins of the views that are still missing
+  Vec3f dir = getViewDirection(i, j);
+  for (unsigned int a = 0; a < view.size(); a++)
+    {
+      for (unsigned int b = 0; b < view[a].size(); b++)
+	{
+	  if (view[a][b] != NULL) continue;
+	  float dist = 1 - dir.Dot3(getViewDirection(a, b));
+	  if (dist < substituteDist[a][b])
+	    {
+	      substitute[a][b] = view[i][j];
+	      substituteDist[a][b] = dist;
+	    }
+	}
+    }
+}
+
+//Forgets who asked for the missing views.
+//Call this before a pass that asks for the views of every visible tree.
+void Hemisphere::clearViewRequests()
+{
+  for (unsigned int i = 0; i < requests.size(); i++)
+    {
+      std::fill(requests[i].begin(), requests[i].end(), 0);
+    }
+}
+
+//Returns true if a view was asked for but has not been computed yet
+bool Hemisphere::hasPendingViews()
+{
+  for (unsigned int i = 0; i < requests.size(); i++)
+    {
+      for (unsigned int j = 0; j < requests[i].size(); j++)
+	{
+	  if (requests[i][j] > 0 || hints[i][j] > 0) return true;
+	}
+    }
+  return false;
+}
+
+//Computes up to maxviews missing views, the most requested ones first.
+//Returns the number of views that were computed.
+int Hemisphere::bakePendingViews(int maxviews)
+{
+  int count = 0;
+  while (count < maxviews)
+    {
+      //Find the view the most trees are waiting for
+      int besti = -1, bestj = -1, best = 0;
+      for (unsigned int i = 0; i < requests.size(); i++)
+	{
+	  for (unsigned int j = 0; j < requests[i].size(); j++)
+	    {
+	      if (requests[i][j] + hints[i][j] > best)
+		{
+		  best = requests[i][j] + hints[i][j];
+		  besti = i;
+		  bestj = j;
+		}
+	    }
+	}
+      if (besti < 0) break;
+
+      bakeView(besti, bestj);
+      count++;
+    }
+
+  return count;
+}
+
+//Marks a view as wanted until it is computed, whoever asks for views
+//in the meantime.  Hints for views that don't exist are ignored.
+void Hemisphere::hintView(int i, int j)
+{
+  if (i < 0 || i >= (int)view.size() || j < 0 || j >= (int)view[i].size()) return;
+  if (view[i][j] == NULL) hints[i][j]++;
+}
+
 //Computes the bounds of the mesh so each view doesn't have to
 void Hemisphere::computeBounds()
 {
@@ -112,28 +254,40 @@ void Hemisphere::computeBounds()
     }
 }
 
-//Returns the nearest view given the angle to that view
-View* Hemisphere::getNearestView(float angXZ, float angY)
+//Finds the level and point of the view nearest to the given angle
+void Hemisphere::getNearestIndex(float angXZ, float angY, int &ylevel, int &xzlevel)
 {
   //Find the corresponding level for angY, rounding to nearest
-  int ylevel = (angY*((levels-1)/(HEMISPHERE_PI/2))) + 0.5;
+  ylevel = (angY*((levels-1)/(HEMISPHERE_PI/2))) + 0.5;
 
   //Just make sure it doesn't round too far
   if (ylevel == levels) ylevel--;
 
   //Find the corresponding point for angXZ, also rounding
-  unsigned int xzlevel = (angXZ*(view[ylevel].size())/(2*HEMISPHERE_PI)) + 0.5;
+  xzlevel = (angXZ*(view[ylevel].size())/(2*HEMISPHERE_PI)) + 0.5;
 
   //Just make sure it doesn't round too far
-  if (xzlevel == view[ylevel].size()) xzlevel--;
+  if (xzlevel == (int)view[ylevel].size()) xzlevel--;
+}
 
-  //Return the view at that point
-  return view[ylevel][xzlevel];
+//Returns the nearest view given the angle to that view
+View* Hemisphere::getNearestView(float angXZ, float angY)
+{
+  int ylevel, xzlevel;
+  getNearestIndex(angXZ, angY, ylevel, xzlevel);
+
+  //Return the view at that point if it exists
+  if (view[ylevel][xzlevel] != NULL) return view[ylevel][xzlevel];
+
+  //Otherwise queue it up, and hand out the closest view we do have.
+  //The very first view has nothing to stand in for it, so make it now.
+  requests[ylevel][xzlevel]++;
+  if (substitute[ylevel][xzlevel] == NULL) bakeView(ylevel, xzlevel);
+  return substitute[ylevel][xzlevel];
 }
 
-//Returns the nearest view given the position of the center
-//and the position of the camera
-View* Hemisphere::getNearestView(Vec3f pos, Vec3f camera)
+//Finds the angles of the camera as seen from the center pos
+void Hemisphere::toAngles(Vec3f pos, Vec3f camera, float &angXZ, float &angY)
 {
   //Find a vector pointing to the camera from the center
   Vec3f toCamera = camera - pos;
@@ -142,18 +296,35 @@ View* Hemisphere::getNearestView(Vec3f pos, Vec3f camera)
   //Convert this to spherical coordinates
   Vec3f xzCamera(toCamera.x(), 0, toCamera.z());
   xzCamera.Normalize();
-  float angXZ = std::acos(xzCamera.x());
+  angXZ = std::acos(xzCamera.x());
   if (toCamera.z() < 0) angXZ *= -1;
-  float angY = std::asin(toCamera.y());
+  angY = std::asin(toCamera.y());
 
   //Bound them to the hemisphere
   while (angXZ < 0) angXZ += 2*HEMISPHERE_PI;
   if (angY < 0) angY = 0;
+}
+
+//Returns the nearest view given the position of the center
+//and the position of the camera
+View* Hemisphere::getNearestView(Vec3f pos, Vec3f camera)
+{
+  float angXZ, angY;
+  toAngles(pos, camera, angXZ, angY);
 
   //Get the nearest view
   return getNearestView(angXZ, angY);
 }
 
+//Finds the level and point of the nearest view, as getNearestView
+//would, without asking for it
+void Hemisphere::getNearestViewIndex(Vec3f pos, Vec3f camera, int &i, int &j)
+{
+  float angXZ, angY;
+  toAngles(pos, camera, angXZ, angY);
+  getNearestIndex(angXZ, angY, i, j);
+}
+
 //Returns the interpolated view given the position of the center
 //and the position of the camera
 View* Hemisphere::getInterpolatedView(Vec3f pos, Vec3f camera)
@@ -11,6 +11,7 @@
 
 #include "vectors.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cfloat>
 #include <vector>
@@ -19,6 +20,7 @@ const float HEMISPHERE_PI = 3.1415926535;
 
 class View;
 class Mesh;
+class ImpostorAtlas;
 class Vec3f;
 struct texel;
 
@@ -27,7 +29,7 @@ class Hemisphere
  public:
   //Constructors
   Hemisphere();
-  Hemisphere(Mesh* inmesh, int inlevels, int inpoints);
+  Hemisphere(Mesh* inmesh, int inlevels, int inpoints, bool inlazy = false);
 
   //Destructor
   ~Hemisphere();
@@ -35,15 +37,31 @@ class Hemisphere
   //Accessors
   View* getView(int i, int j) {return view[i][j];}
   int numViews();
+  int numBakedViews() {return baked;}
+  bool isLazy() {return lazy;}
   Vec3f getCenter() {return (min+max)/2;}
+  //The width of the square each view covers, see View::computeView
+  float getViewSize() {return std::max(std::max(max.x()-min.x(), max.y()-min.y()), max.z()-min.z())*1.1;}
+
+  //Before setup: where the views are kept, and the most of them the
+  //hemisphere may have, which takes away levels and points to fit
+  void setAtlas(ImpostorAtlas* inatlas) {atlas = inatlas;}
+  void limitViews(int maxviews);
 
   //General use functions
   void setup();
   View* getNearestView(float angXZ, float angY);
   View* getNearestView(Vec3f pos, Vec3f camera);
+  void getNearestViewIndex(Vec3f pos, Vec3f camera, int &i, int &j);
   View* getInterpolatedView(Vec3f pos, Vec3f camera);
   View* getInterpolatedView(float angXZ, float angY);
 
+  //Lazy view generation
+  void clearViewRequests();
+  bool hasPendingViews();
+  int bakePendingViews(int maxviews);
+  void hintView(int i, int j);
+
  private:
   //The number of levels of points, including the one at the top
   int levels;
@@ -54,18 +72,45 @@ class Hemisphere
   //The mesh that this hemisphere surrounds
   Mesh* mesh;
 
+  //The atlas the views are kept in
+  ImpostorAtlas* atlas;
+
   //The minimum and maximum bounds of the mesh
   Vec3f min, max;
 
   //The views themselves
   std::vector<std::vector<View*> > view;
 
+  //If true, views are only computed once something asks for them
+  bool lazy;
+
+  //The number of views computed so far
+  int baked;
+
+  //How many trees asked for each missing view since the last clear
+  std::vector<std::vector<int> > requests;
+
+  //Views known to be wanted ahead of time, such as the ones a saved
+  //world was drawn with, which stay wanted until they are computed
+  std::vector<std::vector<int> > hints;
+
+  //The nearest computed view to stand in for each missing view,
+  //and the angular distance (as 1 - cosine) to it
+  std::vector<std::vector<View*> > substitute;
+  std::vector<std::vector<float> > substituteDist;
+
   //Helper functions
   void computeBounds();
+  void getNearestIndex(float angXZ, float angY, int &ylevel, int &xzlevel);
+  void toAngles(Vec3f pos, Vec3f camera, float &angXZ, float &angY);
+  void bakeView(int i, int j);
+  Vec3f getViewDirection(int i, int j);
   Vec3f projectPoint(Vec3f p, Vec3f center, float angXZ, float angY);
   texel getNearestTexel(Vec3f p, Vec3f center, float angXZ, float angY);
   float getXZAngFromLevel(int i) {return (i*HEMISPHERE_PI*2)/view[0].size();}
   float getYAngFromLevel(int i) {return (i*HEMISPHERE_PI*0.5)/(levels-1);}
+  float getXZAngFromPoint(int i, int j) {return (HEMISPHERE_PI*2)*(float(j)/float(view[i].size()));}
+  float getYAngFromPoint(int i);
 };
 
 #endif
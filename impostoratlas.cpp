@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+#include "impostoratlas.h"
+#include "dxt.h"
+
+// the smallest mip level of a cell
+static const int MIN_MIP_SIZE = 8;
+
+// =======================================================================
+// CONSTRUCTOR & CLEANUP
+// =======================================================================
+
+ImpostorAtlas::ImpostorAtlas() :
+  texture(0), cell_size(0), cells_across(0), cells_down(0),
+  num_levels(0), compressed(false), next_cell(0) {
+}
+
+size_t ImpostorAtlas::bytesPerCell() const {
+  size_t bytes = 0;
+  for (int i = 0; i < num_levels; i++) {
+    int size = cell_size >> i;
+    bytes += compressed ? DXTCompressedSize(size, size, DXT_BC3) : size * size * 4;
+  }
+  return bytes;
+}
+
+void ImpostorAtlas::initialize(int cell_size_, size_t budget, int min_cells) {
+  assert (texture == 0);
+  assert (cell_size_ >= MIN_MIP_SIZE && min_cells >= 1);
+  cell_size = cell_size_;
+  compressed = DXTSupported();
+  num_levels = 1;
+  while ((cell_size >> num_levels) >= MIN_MIP_SIZE) num_levels++;
+
+  // as many cells as the budget pays for, in a roughly square texture
+  // no larger than the driver allows
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  int max_across = std::max(1, (int)max_size / cell_size);
+  int cells = std::max(min_cells, (int)(budget / bytesPerCell()));
+  cells_across = std::min(max_across, (int)ceil(sqrt((double)cells)));
+  cells_down = std::max(cells / cells_across, (min_cells + cells_across - 1) / cells_across);
+  cells_down = std::min(max_across, cells_down);
+  next_cell = 0;
+  if (numCells() * bytesPerCell() > budget) {
+    std::cerr << "The impostor atlas needs " << (numCells() * bytesPerCell()) / (1024*1024)
+              << " MB for the fewest views it can do with, more than its budget\n";
+  }
+
+  int width = cells_across * cell_size;
+  int height = cells_down * cell_size;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (compressed) {
+    DXTAllocate(width, height, num_levels, DXT_BC3);
+  } else {
+    for (int i = 0; i < num_levels; i++) {
+      glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, width >> i, height >> i, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  HandleGLError("After setting up the impostor atlas");
+
+  std::cout << "Impostor atlas: " << numCells() << " views in " << width << "x" << height
+            << (compressed ? " BC3" : " RGBA8") << ", "
+            << (numCells() * bytesPerCell()) / (1024*1024) << " MB\n";
+}
+
+void ImpostorAtlas::cleanup() {
+  if (texture != 0) glDeleteTextures(1, &texture);
+  texture = 0;
+  cells_across = cells_down = 0;
+  next_cell = 0;
+}
+
+void ImpostorAtlas::getCellCoords(int cell, float &s0, float &t0, float &s1, float &t1) const {
+  assert (cell >= 0 && cell < numCells());
+  float width = cells_across * cell_size;
+  float height = cells_down * cell_size;
+  int x = (cell % cells_across) * cell_size;
+  int y = (cell / cells_across) * cell_size;
+  s0 = (x + 0.5f) / width;
+  t0 = (y + 0.5f) / height;
+  s1 = (x + cell_size - 0.5f) / width;
+  t1 = (y + cell_size - 0.5f) / height;
+}
+
+void ImpostorAtlas::setLodBias(float bias) {
+  if (texture == 0) return;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, bias);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// =======================================================================
+// CELLS
+// =======================================================================
+
+int ImpostorAtlas::allocateCell() {
+  if (next_cell >= numCells()) return -1;
+  return next_cell++;
+}
+
+// Halves a square RGBA image, weighting the colors by opacity so the
+// background does not bleed into the edges of the tree
+static void downsample(const std::vector<float> &src, int size, std::vector<float> &dst) {
+  int half = size/2;
+  dst.resize(half*half*4);
+  for (int i = 0; i < half; i++) {
+    for (int j = 0; j < half; j++) {
+      float weighted[3] = {0, 0, 0};
+      float plain[3] = {0, 0, 0};
+      float alpha = 0;
+      for (int k = 0; k < 4; k++) {
+        const float *p = &src[4*((2*i + k/2)*size + 2*j + k%2)];
+        for (int c = 0; c < 3; c++) {
+          weighted[c] += p[c]*p[3];
+          plain[c] += p[c];
+        }
+        alpha += p[3];
+      }
+      float *d = &dst[4*(i*half + j)];
+      for (int c = 0; c < 3; c++) {
+        d[c] = (alpha > 0) ? weighted[c]/alpha : plain[c]/4;
+      }
+      d[3] = alpha/4;
+    }
+  }
+}
+
+// Makes the texels around the edge of a square RGBA image transparent,
+// keeping their colors for the filtering of the ones next to them
+static void clearBorder(std::vector<float> &image, int size) {
+  for (int k = 0; k < size; k++) {
+    image[4*k + 3] = 0;
+    image[4*((size-1)*size + k) + 3] = 0;
+    image[4*(k*size) + 3] = 0;
+    image[4*(k*size + size-1) + 3] = 0;
+  }
+}
+
+void ImpostorAtlas::store(int cell, const float *rgba) {
+  assert (texture != 0 && cell >= 0 && cell < next_cell);
+  std::vector<std::vector<float> > chain(1, std::vector<float>(rgba, rgba + cell_size*cell_size*4));
+  for (int i = 1; i < num_levels; i++) {
+    std::vector<float> smaller;
+    downsample(chain.back(), cell_size >> (i-1), smaller);
+    chain.push_back(smaller);
+  }
+  // only once every level has been made from the whole of the one
+  // before it
+  for (int i = 0; i < num_levels; i++) {
+    clearBorder(chain[i], cell_size >> i);
+  }
+
+  int x = (cell % cells_across) * cell_size;
+  int y = (cell / cells_across) * cell_size;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (compressed) {
+    std::vector<std::vector<unsigned char> > bytes(chain.size());
+    for (unsigned int i = 0; i < chain.size(); i++) {
+      bytes[i].resize(chain[i].size());
+      for (unsigned int k = 0; k < chain[i].size(); k++) {
+        bytes[i][k] = (unsigned char)(std::min(std::max(chain[i][k], 0.0f), 1.0f)*255 + 0.5);
+      }
+    }
+    std::vector<DXTLevel> levels;
+    DXTCompressChain(bytes, cell_size, cell_size, DXT_BC3, levels);
+    DXTUploadRegion(levels, DXT_BC3, x, y);
+  } else {
+    for (int i = 0; i < num_levels; i++) {
+      int size = cell_size >> i;
+      glTexSubImage2D(GL_TEXTURE_2D, i, x >> i, y >> i, size, size, GL_RGBA, GL_FLOAT, &chain[i][0]);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// =======================================================================
@@ -0,0 +1,72 @@
+#ifndef _IMPOSTOR_ATLAS_H_
+#define _IMPOSTOR_ATLAS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "glCanvas.h"
+
+// ===================================================================
+// One texture that holds the views of every tree species, a square
+// cell per view, so that the impostors of all the trees are drawn
+// with a single texture bound.
+//
+// The size of the atlas comes from a memory budget, and so does the
+// number of views there is room for.  It is BC3 compressed when the
+// driver supports it.  Each cell has its own mip chain inside the
+// atlas mip levels, so the GPU picks the resolution of a view by how
+// large it is on screen.  The chain stops at 8 texels a side, and the
+// outermost texels of a cell are transparent at every level, so that
+// filtering never brings in the edge of the view next to it.
+
+class ImpostorAtlas {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  ImpostorAtlas();
+  ~ImpostorAtlas() { cleanup(); }
+
+  // needs the GL context.  Room for as many cell_size cells as fit in
+  // budget bytes (with their mip chains), but at least min_cells.
+  void initialize(int cell_size, size_t budget, int min_cells);
+  void cleanup();
+
+  // ==========
+  // PROPERTIES
+  GLuint getTexture() const { return texture; }
+  int numCells() const { return cells_across * cells_down; }
+  int numFreeCells() const { return numCells() - next_cell; }
+  // bytes of GPU memory for one cell and its mip chain
+  size_t bytesPerCell() const;
+  // the texture coordinates of the corners of a cell, inset by half a
+  // texel so that filtering stays inside it
+  void getCellCoords(int cell, float &s0, float &t0, float &s1, float &t1) const;
+  // read the views from lower resolution mip levels than their size on
+  // screen calls for, by bias levels
+  void setLodBias(float bias);
+
+  // =====
+  // CELLS
+  // a cell nobody uses yet, or -1 if the atlas is full
+  int allocateCell();
+  // fill a cell from a square RGBA image of cell_size texels a side
+  void store(int cell, const float *rgba);
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  GLuint texture;
+  int cell_size;
+  int cells_across;
+  int cells_down;
+  int num_levels;
+  bool compressed;
+  int next_cell;
+};
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,154 @@
+#include <cassert>
+
+#include "jobsystem.h"
+
+// which thread of the job system this is; 0 for anything but a worker
+static thread_local int current_thread = 0;
+
+// =======================================================================
+// SCRATCH MEMORY
+// =======================================================================
+
+void* ScratchArena::allocateBytes(size_t bytes, size_t align) {
+  const size_t BLOCK_SIZE = 1 << 16;
+  while (true) {
+    if (block < blocks.size()) {
+      size_t start = (used + align - 1) / align * align;
+      if (start + bytes <= blocks[block].size()) {
+        used = start + bytes;
+        return &blocks[block][start];
+      }
+      if (used == 0) {
+        // an empty block that is too small: put a big enough one first
+        blocks.insert(blocks.begin() + block, std::vector<char>(std::max(BLOCK_SIZE, bytes + align)));
+        continue;
+      }
+      block++;
+      used = 0;
+      continue;
+    }
+    blocks.push_back(std::vector<char>(std::max(BLOCK_SIZE, bytes + align)));
+  }
+}
+
+// =======================================================================
+// STARTING & STOPPING
+// =======================================================================
+
+void JobSystem::start(int threads) {
+  if (running) return;
+  if (threads <= 0) threads = std::thread::hardware_concurrency();
+  threads = std::max(threads, 1);
+  for (int i = 0; i < threads; i++) queues.push_back(new Queue());
+  arenas.resize(threads);
+  running = true;
+  for (int i = 1; i < threads; i++) {
+    workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+  }
+}
+
+void JobSystem::stop() {
+  if (!running) return;
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    running = false;
+  }
+  wake.notify_all();
+  for (unsigned int i = 0; i < workers.size(); i++) workers[i].join();
+  workers.clear();
+  for (unsigned int i = 0; i < queues.size(); i++) {
+    assert (queues[i]->jobs.empty());
+    delete queues[i];
+  }
+  queues.clear();
+}
+
+int JobSystem::threadIndex() const {
+  return (current_thread < numThreads()) ? current_thread : 0;
+}
+
+// only one thread that is not a worker should use the scratch memory
+ScratchArena& JobSystem::scratch() {
+  if (arenas.empty()) arenas.resize(1);
+  return arenas[threadIndex()];
+}
+
+// =======================================================================
+// RUNNING JOBS
+// =======================================================================
+
+void JobSystem::push(const Job &job) {
+  Queue *queue = queues[threadIndex()];
+  {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->jobs.push_back(job);
+  }
+  queued++;
+  // take the lock so a worker between checking for jobs and going to
+  // sleep can't miss this
+  { std::lock_guard<std::mutex> guard(sleep_lock); }
+  wake.notify_one();
+}
+
+// newest job of our own, or else the oldest job of another thread
+bool JobSystem::take(int thread, Job &job) {
+  int n = queues.size();
+  for (int k = 0; k < n; k++) {
+    Queue *queue = queues[(thread + k) % n];
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->jobs.empty()) continue;
+    if (k == 0) {
+      job = queue->jobs.back();
+      queue->jobs.pop_back();
+    } else {
+      job = queue->jobs.front();
+      queue->jobs.pop_front();
+    }
+    queued--;
+    return true;
+  }
+  return false;
+}
+
+bool JobSystem::runOne() {
+  if (queued == 0) return false;
+  Job job;
+  if (!take(threadIndex(), job)) return false;
+  job.work();
+  job.group->pending--;
+  return true;
+}
+
+void JobSystem::workerLoop(int thread) {
+  current_thread = thread;
+  while (running) {
+    if (runOne()) continue;
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    wake.wait(guard, [this]() { return queued > 0 || !running; });
+  }
+}
+
+// =======================================================================
+// TASK GROUPS
+// =======================================================================
+
+void TaskGroup::run(const std::function<void()> &work) {
+  // without workers, just do it now
+  if (jobs.queues.empty()) {
+    work();
+    return;
+  }
+  pending++;
+  JobSystem::Job job;
+  job.work = work;
+  job.group = this;
+  jobs.push(job);
+}
+
+void TaskGroup::wait() {
+  while (pending > 0) {
+    if (!jobs.runOne()) std::this_thread::yield();
+  }
+}
+
+// =======================================================================
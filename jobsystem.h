@@ -0,0 +1,168 @@
+#ifndef _JOB_SYSTEM_H_
+#define _JOB_SYSTEM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// ===================================================================
+// A bump allocator for temporary memory, one per thread of the job
+// system, so jobs can get scratch space without going through the heap
+// or sharing anything.  Memory comes back all at once when the scope
+// that took it ends.
+
+class ScratchArena {
+
+public:
+
+  ScratchArena() : block(0), used(0) {}
+
+  // room for n objects of type T, uninitialized and suitably aligned
+  template <class T> T* allocate(size_t n) {
+    return (T*)allocateBytes(n * sizeof(T), alignof(T));
+  }
+
+  // everything allocated after the mark is freed by rewinding to it
+  struct Mark { size_t block, used; };
+  Mark mark() const { Mark m = { block, used }; return m; }
+  void rewind(const Mark &m) { block = m.block; used = m.used; }
+
+private:
+  void* allocateBytes(size_t bytes, size_t align);
+
+  std::vector<std::vector<char> > blocks;
+  size_t block;
+  size_t used;
+};
+
+// Frees the scratch memory taken in a scope when it ends
+class ScratchScope {
+public:
+  ScratchScope(ScratchArena &a) : arena(a), start(a.mark()) {}
+  ~ScratchScope() { arena.rewind(start); }
+private:
+  ScratchArena &arena;
+  ScratchArena::Mark start;
+};
+
+// ===================================================================
+// A pool of worker threads that share out jobs by work stealing.
+//
+// Every thread has its own queue.  A thread pushes the jobs it makes
+// onto the back of its own queue and takes them from the back again,
+// so related work stays on one core, while idle threads steal from the
+// front of the other queues, where the oldest (and usually largest)
+// jobs are.  A thread that waits for a TaskGroup runs jobs itself
+// until the group is done, so jobs can fork and join other jobs
+// without tying up the pool.
+//
+// Thread 0 is the main thread, or any thread that is not a worker.
+
+class JobSystem {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  JobSystem() : running(false), queued(0) {}
+  ~JobSystem() { stop(); }
+
+  // start threads-1 workers (one per core if threads is 0)
+  void start(int threads = 0);
+  void stop();
+
+  // ==========
+  // PROPERTIES
+  int numThreads() const { return queues.empty() ? 1 : queues.size(); }
+  // the calling thread, from 0 to numThreads()-1
+  int threadIndex() const;
+  ScratchArena& scratch();
+
+  // ======
+  // JOBS
+  // Call f(lo, hi) over [begin, end) in pieces of at least grain items,
+  // and wait for all of them.  The pieces do not depend on how many
+  // threads there are, so neither does anything computed from them.
+  template <class F>
+  void parallelFor(int begin, int end, int grain, const F &f);
+
+private:
+  friend class TaskGroup;
+
+  struct Job {
+    std::function<void()> work;
+    TaskGroup *group;
+  };
+  struct Queue {
+    std::mutex lock;
+    std::deque<Job> jobs;
+  };
+
+  // helper functions
+  void push(const Job &job);
+  bool runOne();
+  bool take(int thread, Job &job);
+  void workerLoop(int thread);
+
+  // ==============
+  // REPRESENTATION
+  std::vector<Queue*> queues;
+  std::vector<std::thread> workers;
+  std::vector<ScratchArena> arenas;
+  std::atomic<bool> running;
+  std::atomic<int> queued;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+};
+
+// ===================================================================
+// Jobs that are waited for together (fork/join).  wait() runs queued
+// jobs while the group's are not done.
+
+class TaskGroup {
+
+public:
+
+  TaskGroup(JobSystem &js) : jobs(js), pending(0) {}
+  ~TaskGroup() { wait(); }
+
+  void run(const std::function<void()> &work);
+  void wait();
+
+private:
+  friend class JobSystem;
+  JobSystem &jobs;
+  std::atomic<int> pending;
+};
+
+// ===================================================================
+
+template <class F>
+void JobSystem::parallelFor(int begin, int end, int grain, const F &f) {
+  grain = std::max(grain, 1);
+  if (end - begin <= grain || numThreads() == 1) {
+    for (int lo = begin; lo < end; lo += grain) f(lo, std::min(end, lo + grain));
+    return;
+  }
+  TaskGroup group(*this);
+  for (int lo = begin; lo < end; lo += grain) {
+    int hi = std::min(end, lo + grain);
+    group.run([&f, lo, hi]() { f(lo, hi); });
+  }
+  group.wait();
+}
+
+// the job system everything shares, started in main
+extern JobSystem GLOBAL_jobs;
+
+// ===================================================================
+
+#endif
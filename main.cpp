@@ -2,34 +2,58 @@
 
 #include <time.h>
 
-#include "MersenneTwister.h"
+#include "counterrng.h"
 #include <iostream> 
 #include "argparser.h"
 #include "mesh.h"
 #include "hemisphere.h"
 #include "forest.h"
+#include "jobsystem.h"
 
-MTRand GLOBAL_mtrand;
+CounterRNG GLOBAL_rng;
+JobSystem GLOBAL_jobs;
 
 // =========================================
 // =========================================
 
 int main(int argc, char *argv[]) {
 
-  // deterministic (repeatable) randomness
-  // GLOBAL_mtrand = MTRand(37);
-  // "real" randomness
-  GLOBAL_mtrand = MTRand((unsigned)time(0));
-  //
-  
+  // "real" randomness, unless a seed is given with -seed for a
+  // deterministic (repeatable) world
   ArgParser args(argc, argv);
-  Mesh mesh(&args);
-  Hemisphere hemisphere(&mesh, 10, 30);
-  Forest forest(&args, &hemisphere);
+  GLOBAL_rng.seed(args.seed);
+  GLOBAL_jobs.start(args.threads);
+  
+  // a mesh and a hemisphere of views for every species of tree (at
+  // least one, even if no -input was given, as before)
+  if (args.input_files.empty()) args.input_files.push_back("");
+  std::vector<Mesh*> meshes;
+  std::vector<Hemisphere*> hemispheres;
+  for (unsigned int i = 0; i < args.input_files.size(); i++) {
+    meshes.push_back(new Mesh(&args));
+    hemispheres.push_back(new Hemisphere(meshes[i], 10, 30, args.lazy_views));
+  }
+  Forest forest(&args, meshes, hemispheres);
+
+  // the meshes (with their textures) are read and the world is made on
+  // the job system while the window and GL context come up on this thread
+  TaskGroup mesh_loading(GLOBAL_jobs), world_loading(GLOBAL_jobs);
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    Mesh *mesh = meshes[i];
+    const std::string &input = args.input_files[i];
+    mesh_loading.run([mesh, &input]() { mesh->Load(input); });
+  }
+  world_loading.run([&]() { forest.createWorld(); });
+
+  // without a window the program ends after the camera path, as it
+  // would when the window is closed, without tearing down the forest
+  // and meshes after their GL context
+  if (args.headless) {
+    exit(GLCanvas::runHeadless(&args,meshes,&forest,&mesh_loading,&world_loading));
+  }
 
-  mesh.Load(args.input_file);
   glutInit(&argc,argv);
-  GLCanvas::initialize(&args,&mesh,&hemisphere,&forest); 
+  GLCanvas::initialize(&args,meshes,&forest,&mesh_loading,&world_loading);
 
   return 0;
 }
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include "material.h"
+#include "dxt.h"
 #include "utils.h"
 #include "ray.h"
 #include "hit.h"
@@ -14,6 +16,27 @@ Material::~Material() {
   }
 }
 
+// ==================================================================
+// TEXTURE FILE
+// ==================================================================
+void Material::loadTexture() {
+  if (!hasTextureMap() || image != NULL) return;
+  image = new Image(textureFile);
+  ComputeAverageTextureColor();
+  // compressed textures are made of 4x4 blocks; the compressed mip
+  // chain is kept next to the texture, so it only has to be built the
+  // first time
+  if (image->Width() % 4 == 0 && image->Height() % 4 == 0) {
+    std::string cache = textureFile + ".dxt";
+    if (!DXTLoadCache(cache, textureFile, image->Width(), image->Height(), DXT_BC1, dxt_levels)) {
+      std::vector<std::vector<unsigned char> > chain;
+      BuildMipChain(chain);
+      DXTCompressChain(chain, image->Width(), image->Height(), DXT_BC1, dxt_levels);
+      DXTSaveCache(cache, DXT_BC1, dxt_levels);
+    }
+  }
+}
+
 // ==================================================================
 // TEXTURE LOOKUP FOR DIFFUSE COLOR
 // ==================================================================
@@ -46,6 +69,7 @@ const Vec3f Material::getDiffuseColor(double s, double t) const {
 // ==================================================================
 GLuint Material::getTextureID() { 
   assert (hasTextureMap()); 
+  assert (image != NULL);
 
   // if this is the first time the texture is being used, we must
   // initialize it
@@ -68,14 +92,62 @@ GLuint Material::getTextureID() {
     // to be most compatible, textures should be square and a power of 2
     //assert (image->Width() == image->Height());
     //assert (image->Width() == 256);
-    // build our texture mipmaps
-    gluBuild2DMipmaps( GL_TEXTURE_2D, 3, image->Width(), image->Height(),
-		       GL_RGB, GL_UNSIGNED_BYTE, image->getGLPixelData());
+    // the compressed levels were made by loadTexture, other sizes are
+    // left to the driver
+    if (DXTSupported() && !dxt_levels.empty()) {
+      DXTUpload(dxt_levels, DXT_BC1);
+    } else {
+      // build our texture mipmaps
+      gluBuild2DMipmaps( GL_TEXTURE_2D, 3, image->Width(), image->Height(),
+                         GL_RGB, GL_UNSIGNED_BYTE, image->getGLPixelData());
+    }
+    // the texture lives on the GPU from now on
+    std::vector<DXTLevel>().swap(dxt_levels);
   }
   
   return texture_id;
 }
 
+// ==================================================================
+// A box filtered RGBA mip chain of the texture, down to 1x1
+// ==================================================================
+void Material::BuildMipChain(std::vector<std::vector<unsigned char> > &chain) const {
+  assert (hasTextureMap());
+  int w = image->Width();
+  int h = image->Height();
+  chain.clear();
+  chain.push_back(std::vector<unsigned char>(w*h*4));
+  for (int j = 0; j < h; j++) {
+    for (int i = 0; i < w; i++) {
+      Color c = image->GetPixel(i,j);
+      unsigned char *p = &chain[0][4*(j*w+i)];
+      p[0] = c.r; p[1] = c.g; p[2] = c.b; p[3] = 255;
+    }
+  }
+  while (w > 1 || h > 1) {
+    int w2 = std::max(1, w/2);
+    int h2 = std::max(1, h/2);
+    std::vector<unsigned char> smaller(w2*h2*4);
+    const std::vector<unsigned char> &src = chain.back();
+    for (int j = 0; j < h2; j++) {
+      for (int i = 0; i < w2; i++) {
+        // the odd row or column of a dimension that is already 1 is
+        // simply repeated
+        int i0 = std::min(2*i, w-1), i1 = std::min(2*i+1, w-1);
+        int j0 = std::min(2*j, h-1), j1 = std::min(2*j+1, h-1);
+        for (int c = 0; c < 4; c++) {
+          int sum = src[4*(j0*w+i0)+c] + src[4*(j0*w+i1)+c] +
+            src[4*(j1*w+i0)+c] + src[4*(j1*w+i1)+c];
+          smaller[4*(j*w2+i)+c] = (sum + 2) / 4;
+        }
+      }
+    }
+    chain.push_back(smaller);
+    w = w2;
+    h = h2;
+  }
+}
+
 // ==================================================================
 // An average texture color, a hack for use in radiosity
 // ==================================================================
@@ -4,8 +4,10 @@
 #include "glCanvas.h"
 #include <cassert>
 #include <string>
+#include <vector>
 #include "vectors.h"
 #include "image.h"
+#include "dxt.h"
 
 class ArgParser;
 class Ray;
@@ -22,13 +24,9 @@ public:
   Material(const std::string &texture_file, const Vec3f &d_color,
 	   const Vec3f &r_color, const Vec3f &e_color, double roughness_) {
     textureFile = texture_file;
-    if (textureFile != "") {
-      image = new Image(textureFile);
-      ComputeAverageTextureColor();
-    } else {
-      diffuseColor = d_color;
-      image = NULL;
-    }
+    diffuseColor = d_color;
+    // the texture file is read later, by loadTexture
+    image = NULL;
     reflectiveColor = r_color;
     emittedColor = e_color;
     roughness = roughness_;
@@ -38,6 +36,11 @@ public:
   
   ~Material();
 
+  // Read the texture file, if there is one.  Needs no GL context, so
+  // the textures of several materials can be read at once on other
+  // threads; it must be done before the material is used.
+  void loadTexture();
+
   // ACCESSORS
   const Vec3f& getDiffuseColor() const { return diffuseColor; }
   const Vec3f getDiffuseColor(double s, double t) const;
@@ -61,6 +64,7 @@ protected:
   const Material& operator=(const Material&) { exit(0); }
 
   void ComputeAverageTextureColor();
+  void BuildMipChain(std::vector<std::vector<unsigned char> > &chain) const;
 
   // REPRESENTATION
   Vec3f diffuseColor;
@@ -71,6 +75,8 @@ protected:
   std::string textureFile;
   GLuint texture_id;
   Image *image;
+  // the compressed mip chain, from loadTexture until it is uploaded
+  std::vector<DXTLevel> dxt_levels;
 };
 
 // ====================================================================
@@ -159,6 +159,25 @@ Matrix operator*(const Matrix& m1, const Matrix& m2) {
   return answer;
 }
 
+Matrix& Matrix::operator*=(const Matrix& m) {
+  if (&m == this) { Matrix copy(m); return *this *= copy; }
+  // each row of the product only needs the same row of this matrix,
+  // so the rows can be replaced one at a time
+  for (int row=0; row<4; row++) {
+    double r[4];
+    for (int col=0; col<4; col++) {
+      r[col] = 0;
+      for (int i=0; i<4; i++) {
+        r[col] += data[row+i*4] * m.data[i+col*4];
+      }
+    }
+    for (int col=0; col<4; col++) {
+      data[row+col*4] = r[col];
+    }
+  }
+  return *this;
+}
+
 Vec3f operator*(const Matrix& m1, const Vec3f& v) {
   Vec3f answer = v;
   m1.Transform(answer);
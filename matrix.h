@@ -54,10 +54,11 @@ public:
   friend Vec3f operator*(const Matrix &m1, const Vec3f &v);
   friend Matrix operator*(const Matrix &m1, double d);
   friend Matrix operator*(double d, const Matrix &m) { return m * d; }
-  Matrix& operator+=(const Matrix& m) { *this = *this + m; return *this; }
-  Matrix& operator-=(const Matrix& m) { *this = *this - m; return *this; }
-  Matrix& operator*=(const double d)  { *this = *this * d; return *this; }
-  Matrix& operator*=(const Matrix& m) { *this = *this * m; return *this; }
+  // in place, without a temporary Matrix
+  Matrix& operator+=(const Matrix& m) { for (int i = 0; i < 16; i++) data[i] += m.data[i]; return *this; }
+  Matrix& operator-=(const Matrix& m) { for (int i = 0; i < 16; i++) data[i] -= m.data[i]; return *this; }
+  Matrix& operator*=(const double d)  { for (int i = 0; i < 16; i++) data[i] *= d; return *this; }
+  Matrix& operator*=(const Matrix& m);
 
   // ---------------
   // TRANSFORMATIONS
@@ -4,17 +4,20 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <limits>
 
 #include "mesh.h"
 #include "edge.h"
 #include "vertex.h"
 #include "triangle.h"
 #include "argparser.h"
+#include "jobsystem.h"
+#include "meshsimplifier.h"
 
 #include "seeder.h"
 #include "terraingenerator.h"
 
-int Triangle::next_triangle_id = 0;
+std::atomic<int> Triangle::next_triangle_id(0);
 
 // helper for VBOs
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
@@ -30,23 +33,8 @@ bool ltEdge (const Edge* edge1, const Edge* edge2)
 
 Mesh::~Mesh() {
   cleanupVBOs();
-
-  // delete all the triangles
-  std::vector<Triangle*> todo;
-  for (triangleshashtype::iterator iter = triangles[0].begin();
-       iter != triangles[0].end(); iter++) {
-    Triangle *t = iter->second;
-    todo.push_back(t);
-  }
-  int num_triangles = todo.size();
-  for (int i = 0; i < num_triangles; i++) {
-    removeTriangle(todo[i]);
-  }
-  // delete all the vertices
-  int num_vertices = numVertices();
-  for (int i = 0; i < num_vertices; i++) {
-    delete vertices[0][i];
-  }
+  // the vertices, edges and triangles all go at once with their pools,
+  // there is no need to unlink them one by one
 }
 
 // =======================================================================
@@ -55,7 +43,7 @@ Mesh::~Mesh() {
 
 Vertex* Mesh::addVertex(const Vec3f &position, int mat) {
   int index = numVertices();
-  Vertex *v = new Vertex(index, position);
+  Vertex *v = vertex_pool.create(index, position);
   vertices[0].push_back(v);
   if (mat != -1) vertices[mat+1].push_back(v);
   return v;
@@ -63,33 +51,29 @@ Vertex* Mesh::addVertex(const Vec3f &position, int mat) {
 
 int Mesh::addTriangle(Vertex *a, Vertex *b, Vertex *c, int mat) {
   // create the triangle
-  Triangle *t = new Triangle();
-  // create the edges
-  Edge *ea = new Edge(a,b,t);
-  Edge *eb = new Edge(b,c,t);
-  Edge *ec = new Edge(c,a,t);
+  Triangle *t = triangle_pool.create();
+  // create the edges (next to each other in the pool)
+  Edge *ea = edge_pool.create(a,b,t);
+  Edge *eb = edge_pool.create(b,c,t);
+  Edge *ec = edge_pool.create(c,a,t);
   // point the triangle to one of its edges
   t->setEdge(ea);
   // connect the edges to each other
   ea->setNext(eb);
   eb->setNext(ec);
   ec->setNext(ea);
-  // verify these edges aren't already in the mesh 
-  // (which would be a bug, or a non-manifold mesh)
-  assert (edges[0].find(std::make_pair(a,b)) == edges[0].end());
-  assert (edges[0].find(std::make_pair(b,c)) == edges[0].end());
-  assert (edges[0].find(std::make_pair(c,a)) == edges[0].end());
-  // add the edges to the master list
-  edges[0][std::make_pair(a,b)] = ea;
-  edges[0][std::make_pair(b,c)] = eb;
-  edges[0][std::make_pair(c,a)] = ec;
+  // add the edges to the master list (insert verifies they aren't
+  // already in the mesh, which would be a bug, or a non-manifold mesh)
+  edges[0].insert(a,b,ea);
+  edges[0].insert(b,c,eb);
+  edges[0].insert(c,a,ec);
   // connect up with opposite edges (if they exist)
-  edgeshashtype::iterator ea_op = edges[0].find(std::make_pair(b,a)); 
-  edgeshashtype::iterator eb_op = edges[0].find(std::make_pair(c,b)); 
-  edgeshashtype::iterator ec_op = edges[0].find(std::make_pair(a,c)); 
-  if (ea_op != edges[0].end()) { ea_op->second->setOpposite(ea); }
-  if (eb_op != edges[0].end()) { eb_op->second->setOpposite(eb); }
-  if (ec_op != edges[0].end()) { ec_op->second->setOpposite(ec); }
+  Edge *ea_op = edges[0].find(b,a);
+  Edge *eb_op = edges[0].find(c,b);
+  Edge *ec_op = edges[0].find(a,c);
+  if (ea_op != NULL) { ea_op->setOpposite(ea); }
+  if (eb_op != NULL) { eb_op->setOpposite(eb); }
+  if (ec_op != NULL) { ec_op->setOpposite(ec); }
   // add the triangle to the master list
   assert (triangles[0].find(t->getID()) == triangles[0].end());
   triangles[0][t->getID()] = t;
@@ -97,9 +81,9 @@ int Mesh::addTriangle(Vertex *a, Vertex *b, Vertex *c, int mat) {
   if (mat != -1)
     {
       mat++;
-      edges[mat][std::make_pair(a,b)] = ea;
-      edges[mat][std::make_pair(b,c)] = eb;
-      edges[mat][std::make_pair(c,a)] = ec;
+      edges[mat].insert(a,b,ea);
+      edges[mat].insert(b,c,eb);
+      edges[mat].insert(c,a,ec);
       triangles[mat][t->getID()] = t;
     }
   
@@ -115,22 +99,20 @@ void Mesh::removeTriangle(Triangle *t, int mat) {
   Vertex *b = eb->getStartVertex();
   Vertex *c = ec->getStartVertex();
   // remove these elements from master lists
-  edges[0].erase(std::make_pair(a,b)); 
-  edges[0].erase(std::make_pair(b,c)); 
-  edges[0].erase(std::make_pair(c,a)); 
+  edges[0].erase(a,b);
+  edges[0].erase(b,c);
+  edges[0].erase(c,a);
   triangles[0].erase(t->getID());
   if (mat != -1) triangles[mat+1].erase(t->getID());
   // clean up memory
-  delete ea;
-  delete eb;
-  delete ec;
-  delete t;
+  edge_pool.destroy(ea);
+  edge_pool.destroy(eb);
+  edge_pool.destroy(ec);
+  triangle_pool.destroy(t);
 }
 
 Edge* Mesh::getEdge(Vertex *a, Vertex *b) const {
-  edgeshashtype::const_iterator iter = edges[0].find(std::make_pair(a,b));
-  if (iter == edges[0].end()) return NULL;
-  return iter->second;
+  return edges[0].find(a,b);
 }
 
 // =======================================================================
@@ -151,6 +133,20 @@ void Mesh::Load(const std::string &input_file) {
   int last_slash = input_file.rfind("/");
   std::string directory = input_file.substr(0,last_slash+1);
 
+  // count the vertices and faces first, so that the tables and pools
+  // are allocated once instead of growing while the mesh is read
+  int num_verts = 0, num_faces = 0;
+  {
+    std::string first;
+    while (istr >> first) {
+      if (first == "v") num_verts++;
+      else if (first == "f") num_faces++;
+      istr.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    istr.clear();
+    istr.seekg(0);
+  }
+
   //Give all mesh vectors their [0]
   vertices.resize(1);
   edges.resize(1);
@@ -159,6 +155,12 @@ void Mesh::Load(const std::string &input_file) {
   mesh_tri_verts_VBO.resize(0);
   mesh_tri_indices_VBO.resize(0);
   mesh_tri_texcoords_VBO.resize(0);
+  vertices[0].reserve(num_verts);
+  edges[0].reserve(3*num_faces);
+  triangles[0].reserve(num_faces);
+  vertex_pool.reserve(num_verts);
+  edge_pool.reserve(3*num_faces);
+  triangle_pool.reserve(num_faces);
 
   char line[MAX_CHAR_PER_LINE];
   std::string token, token2;
@@ -170,6 +172,8 @@ void Mesh::Load(const std::string &input_file) {
   Material *active_material = NULL;
   int mat_index = -1;
   std::vector<std::pair<float, float> > textures;
+  // the texture images are read on other threads while parsing goes on
+  TaskGroup texture_loading(GLOBAL_jobs);
 
   // read in each line of the file
   while (istr.getline(line,MAX_CHAR_PER_LINE)) { 
@@ -228,7 +232,9 @@ void Mesh::Load(const std::string &input_file) {
       // prepend the directory name
       texture_file = directory + texture_file;
       
-      materials.push_back(new Material(texture_file,Vec3f(1,1,1),Vec3f(0,0,0),Vec3f(0,0,0),0));
+      Material *material = new Material(texture_file,Vec3f(1,1,1),Vec3f(0,0,0),Vec3f(0,0,0),0);
+      texture_loading.run([material]() { material->loadTexture(); });
+      materials.push_back(material);
       vertices.push_back(std::vector<Vertex*>());
       edges.push_back(edgeshashtype());
       triangles.push_back(triangleshashtype());
@@ -242,6 +248,7 @@ void Mesh::Load(const std::string &input_file) {
       printf ("LINE: '%s'",line);
     }
   }
+  texture_loading.wait();
 }
 
 // =======================================================================
@@ -278,9 +285,141 @@ void Mesh::setupVBOs() {
     {
       setupTriVBOs(i);
     }
+  setupLODVBOs();
   HandleGLError("leaving setup mesh");
 }
 
+// returns which corner of the triangle is at vertex v
+static int cornerOf(Triangle *t, Vertex *v) {
+  for (int i = 0; i < 3; i++) {
+    if ((*t)[i] == v) return i;
+  }
+  assert(0);
+  return -1;
+}
+
+// build a chain of simplified meshes for drawing trees at a distance.
+// Each material group is simplified on its own so groups never merge,
+// and vertices on open edges, material borders and texture seams
+// (found with the half-edge opposites) are locked in place.
+void Mesh::setupLODVBOs() {
+  static const float ratios[] = { 0.5f, 0.25f, 0.1f };
+  std::vector<float> lod_ratios(ratios, ratios + sizeof(ratios)/sizeof(float));
+
+  // cleanup old buffer data (if any)
+  for (unsigned int l = 0; l < lods.size(); l++) {
+    glDeleteBuffers(numMaterials(), &lods[l].tri_verts_VBO[0]);
+    glDeleteBuffers(numMaterials(), &lods[l].tri_indices_VBO[0]);
+    glDeleteBuffers(numMaterials(), &lods[l].tri_texcoords_VBO[0]);
+  }
+  lods = std::vector<MeshLOD>(lod_ratios.size());
+  if (numMaterials() == 0) { lods.clear(); return; }
+  for (unsigned int l = 0; l < lods.size(); l++) {
+    lods[l].ratio = lod_ratios[l];
+    lods[l].num_tris = std::vector<unsigned int>(numMaterials(), 0);
+    lods[l].tri_verts_VBO = std::vector<GLuint>(numMaterials(), 0);
+    lods[l].tri_indices_VBO = std::vector<GLuint>(numMaterials(), 0);
+    lods[l].tri_texcoords_VBO = std::vector<GLuint>(numMaterials(), 0);
+    glGenBuffers(numMaterials(), &lods[l].tri_verts_VBO[0]);
+    glGenBuffers(numMaterials(), &lods[l].tri_indices_VBO[0]);
+    glGenBuffers(numMaterials(), &lods[l].tri_texcoords_VBO[0]);
+  }
+
+  std::vector<Vec3f> positions(numVertices());
+  for (int i = 0; i < numVertices(); i++) {
+    positions[i] = getVertex(i)->getPos();
+  }
+
+  for (int mat = 0; mat < numMaterials(); mat++) {
+    std::vector<SimplifierTri> tris;
+    std::vector<bool> locked(numVertices(), false);
+    for (triangleshashtype::iterator iter = triangles[mat+1].begin();
+         iter != triangles[mat+1].end(); iter++) {
+      Triangle *t = iter->second;
+      SimplifierTri st((*t)[0]->getIndex(), (*t)[1]->getIndex(), (*t)[2]->getIndex());
+      for (int j = 0; j < 3; j++) {
+        st.s[j] = t->get_s(j);
+        st.t[j] = t->get_t(j);
+      }
+      tris.push_back(st);
+
+      // check each edge against the triangle on the other side
+      Edge *e = t->getEdge();
+      for (int j = 0; j < 3; j++, e = e->getNext()) {
+        Vertex *a = e->getStartVertex();
+        Vertex *b = e->getEndVertex();
+        Edge *op = e->getOpposite();
+        bool lock = (op == NULL);
+        if (!lock) {
+          Triangle *o = op->getTriangle();
+          if (triangles[mat+1].find(o->getID()) == triangles[mat+1].end()) {
+            lock = true;
+          } else {
+            int ta = cornerOf(t,a), tb = cornerOf(t,b);
+            int oa = cornerOf(o,a), ob = cornerOf(o,b);
+            lock = (t->get_s(ta) != o->get_s(oa) || t->get_t(ta) != o->get_t(oa) ||
+                    t->get_s(tb) != o->get_s(ob) || t->get_t(tb) != o->get_t(ob));
+          }
+        }
+        if (lock) {
+          locked[a->getIndex()] = true;
+          locked[b->getIndex()] = true;
+        }
+      }
+    }
+
+    MeshSimplifier simplifier(positions, tris, locked);
+    std::vector<std::vector<SimplifierTri> > levels = simplifier.simplify(lod_ratios);
+
+    for (unsigned int l = 0; l < levels.size(); l++) {
+      const std::vector<SimplifierTri> &level = levels[l];
+      unsigned int num_tris = level.size();
+      VBOTriVert* lod_tri_verts = new VBOTriVert[num_tris*3];
+      VBOTri* lod_tri_indices = new VBOTri[num_tris];
+      VBOTex* lod_tri_texcoords = new VBOTex[num_tris*3];
+      for (unsigned int i = 0; i < num_tris; i++) {
+        Vec3f a = positions[level[i].verts[0]];
+        Vec3f b = positions[level[i].verts[1]];
+        Vec3f c = positions[level[i].verts[2]];
+        Vec3f normal = ComputeNormal(a,b,c);
+        lod_tri_verts[i*3]   = VBOTriVert(a,normal);
+        lod_tri_verts[i*3+1] = VBOTriVert(b,normal);
+        lod_tri_verts[i*3+2] = VBOTriVert(c,normal);
+        lod_tri_indices[i] = VBOTri(i*3,i*3+1,i*3+2);
+        for (int j = 0; j < 3; j++) {
+          lod_tri_texcoords[i*3+j] = VBOTex(level[i].s[j], level[i].t[j]);
+        }
+      }
+
+      lods[l].num_tris[mat] = num_tris;
+      glBindBuffer(GL_ARRAY_BUFFER,lods[l].tri_verts_VBO[mat]);
+      glBufferData(GL_ARRAY_BUFFER,
+                   sizeof(VBOTriVert) * num_tris * 3,
+                   lod_tri_verts,
+                   GL_STATIC_DRAW);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,lods[l].tri_indices_VBO[mat]);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   sizeof(VBOTri) * num_tris,
+                   lod_tri_indices, GL_STATIC_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER,lods[l].tri_texcoords_VBO[mat]);
+      glBufferData(GL_ARRAY_BUFFER,
+                   sizeof(VBOTex) * num_tris * 3,
+                   lod_tri_texcoords,
+                   GL_STATIC_DRAW);
+
+      delete [] lod_tri_verts;
+      delete [] lod_tri_indices;
+      delete [] lod_tri_texcoords;
+    }
+  }
+
+  for (unsigned int l = 0; l < lods.size(); l++) {
+    unsigned int total = 0;
+    for (int mat = 0; mat < numMaterials(); mat++) total += lods[l].num_tris[mat];
+    std::cout << "LOD " << l+1 << ": " << total << " of " << numTriangles() << " triangles\n";
+  }
+}
+
 void Mesh::setupTriVBOs(int mat) {
   VBOTriVert* mesh_tri_verts;
   VBOTri* mesh_tri_indices;
@@ -292,62 +431,70 @@ void Mesh::setupTriVBOs(int mat) {
   mesh_tri_indices = new VBOTri[num_tris];
   mesh_tri_texcoords = new VBOTex[num_tris*3];
 
+  // the triangles in a list, so their vertices can be written as jobs
+  std::vector<Triangle*> tris;
+  tris.reserve(num_tris);
+  for (triangleshashtype::iterator iter = triangles[mat+1].begin();
+       iter != triangles[mat+1].end(); iter++) {
+    tris.push_back(iter->second);
+  }
+
   // write the vertex & triangle data
-  unsigned int i = 0;
-  triangleshashtype::iterator iter = triangles[mat+1].begin();
-  for (; iter != triangles[mat].end(); iter++,i++) {
-    Triangle *t = iter->second;
-    Vec3f a = (*t)[0]->getPos();
-    Vec3f b = (*t)[1]->getPos();
-    Vec3f c = (*t)[2]->getPos();
+  GLOBAL_jobs.parallelFor(0, num_tris, 1024, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      Triangle *t = tris[i];
+      Vec3f a = (*t)[0]->getPos();
+      Vec3f b = (*t)[1]->getPos();
+      Vec3f c = (*t)[2]->getPos();
     
-    if (args->gouraud) {
+      if (args->gouraud) {
 
 
-      // =====================================
-      // ASSIGNMENT: reimplement 
-      // =====================================
-      Edge *e = t->getEdge();
-      Triangle *triangle = t;
-      std::vector<Vec3f> normals;
+        // =====================================
+        // ASSIGNMENT: reimplement 
+        // =====================================
+        Edge *e = t->getEdge();
+        Triangle *triangle = t;
+        std::vector<Vec3f> normals;
       
-      //  Iterate on all three vertices
-      for (int j = 0; j < 3; ++j) {
-        normals.clear();
+        //  Iterate on all three vertices
+        for (int j = 0; j < 3; ++j) {
+          normals.clear();
         
-        //  Iterate on all triangles surrounding the vertex
-        do {
-          Vec3f pt1 = (*triangle)[0]->getPos();
-          Vec3f pt2 = (*triangle)[1]->getPos();
-          Vec3f pt3 = (*triangle)[2]->getPos();
+          //  Iterate on all triangles surrounding the vertex
+          do {
+            Vec3f pt1 = (*triangle)[0]->getPos();
+            Vec3f pt2 = (*triangle)[1]->getPos();
+            Vec3f pt3 = (*triangle)[2]->getPos();
           
-          normals.push_back(ComputeNormal(pt1, pt2, pt3));
+            normals.push_back(ComputeNormal(pt1, pt2, pt3));
           
-          e = e->getNext()->getOpposite();
-          triangle = e->getTriangle();
-        } while (triangle != t);
+            e = e->getNext()->getOpposite();
+            triangle = e->getTriangle();
+          } while (triangle != t);
         
-        Vec3f normal = normals[0];
-        for (unsigned int k = 0; k < normals.size(); k++) {
-          normal += normals[k];
-        }
-        normal.Normalize();
+          Vec3f normal = normals[0];
+          for (unsigned int k = 0; k < normals.size(); k++) {
+            normal += normals[k];
+          }
+          normal.Normalize();
         
-        mesh_tri_verts[i*3 + j] = VBOTriVert(e->getEndVertex()->getPos(), normal);
+          mesh_tri_verts[i*3 + j] = VBOTriVert(e->getEndVertex()->getPos(), normal);
         
-        e = e->getNext();
+          e = e->getNext();
+        }
+      } else {
+        Vec3f normal = ComputeNormal(a,b,c);
+        mesh_tri_verts[i*3]   = VBOTriVert(a,normal);
+        mesh_tri_verts[i*3+1] = VBOTriVert(b,normal);
+        mesh_tri_verts[i*3+2] = VBOTriVert(c,normal);
       }
-    } else {
-      Vec3f normal = ComputeNormal(a,b,c);
-      mesh_tri_verts[i*3]   = VBOTriVert(a,normal);
-      mesh_tri_verts[i*3+1] = VBOTriVert(b,normal);
-      mesh_tri_verts[i*3+2] = VBOTriVert(c,normal);
+      mesh_tri_indices[i] = VBOTri(i*3,i*3+1,i*3+2);
+      mesh_tri_texcoords[i*3] = VBOTex(t->get_s(0), t->get_t(0));
+      mesh_tri_texcoords[i*3+1] = VBOTex(t->get_s(1), t->get_t(1));
+      mesh_tri_texcoords[i*3+2] = VBOTex(t->get_s(2), t->get_t(2));
     }
-    mesh_tri_indices[i] = VBOTri(i*3,i*3+1,i*3+2);
-    mesh_tri_texcoords[i*3] = VBOTex(t->get_s(0), t->get_t(0));
-    mesh_tri_texcoords[i*3+1] = VBOTex(t->get_s(1), t->get_t(1));
-    mesh_tri_texcoords[i*3+2] = VBOTex(t->get_s(2), t->get_t(2));
-  }
+  });
 
   // cleanup old buffer data (if any)
   glDeleteBuffers(1, (&mesh_tri_verts_VBO[mat]));
@@ -504,6 +651,12 @@ void Mesh::setupGndTriVBOs() {
 }
 
 void Mesh::cleanupVBOs() {
+  for (unsigned int l = 0; l < lods.size(); l++) {
+    glDeleteBuffers(numMaterials(), &lods[l].tri_verts_VBO[0]);
+    glDeleteBuffers(numMaterials(), &lods[l].tri_indices_VBO[0]);
+    glDeleteBuffers(numMaterials(), &lods[l].tri_texcoords_VBO[0]);
+  }
+  lods.clear();
   glDeleteBuffers(numMaterials(), &mesh_tri_verts_VBO[0]);
   glDeleteBuffers(numMaterials(), &mesh_tri_indices_VBO[0]);
   glDeleteBuffers(numMaterials(), &mesh_tri_texcoords_VBO[0]);
@@ -573,6 +726,76 @@ void Mesh::drawVBOs() {
   HandleGLError("leaving draw VBOs");
 }
 
+// draw a copy of the mesh for each instance, moving the given center
+// of the mesh to the instance position.  The vertex arrays of each
+// material are only set up once for all of the copies.
+void Mesh::drawVBOsInstanced(const std::vector<MeshInstance> &instances, const Vec3f &center, int lod) {
+
+  HandleGLError("in draw mesh instanced");
+  if (instances.size() == 0) return;
+
+  glDisable(GL_LIGHTING);
+  glColor3f(1.0,1.0,1.0);
+  glMatrixMode(GL_MODELVIEW);
+
+  for (int i = 0; i < numMaterials(); i++)
+    {
+      // pick the buffers of the requested level of detail
+      unsigned int num_tris = triangles[i+1].size();
+      GLuint verts_VBO = mesh_tri_verts_VBO[i];
+      GLuint indices_VBO = mesh_tri_indices_VBO[i];
+      GLuint texcoords_VBO = mesh_tri_texcoords_VBO[i];
+      if (lod > 0) {
+        assert (lod < numLODs());
+        num_tris = lods[lod-1].num_tris[i];
+        verts_VBO = lods[lod-1].tri_verts_VBO[i];
+        indices_VBO = lods[lod-1].tri_indices_VBO[i];
+        texcoords_VBO = lods[lod-1].tri_texcoords_VBO[i];
+      }
+
+      glBindTexture(GL_TEXTURE_2D, materials[i]->getTextureID());
+
+      glBindBuffer(GL_ARRAY_BUFFER, texcoords_VBO);
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      glTexCoordPointer(2, GL_FLOAT, 0, BUFFER_OFFSET(0));
+      glBindBuffer(GL_ARRAY_BUFFER, verts_VBO);
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glVertexPointer(3, GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(0));
+      glEnableClientState(GL_NORMAL_ARRAY);
+      glNormalPointer(GL_FLOAT, sizeof(VBOTriVert), BUFFER_OFFSET(12));
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_VBO);
+
+      for (unsigned int j = 0; j < instances.size(); j++)
+	{
+	  const MeshInstance &inst = instances[j];
+	  if (inst.stipple != NULL)
+	    {
+	      glEnable(GL_POLYGON_STIPPLE);
+	      glPolygonStipple(inst.stipple);
+	    }
+	  glPushMatrix();
+	  glTranslatef(inst.x, inst.y, inst.z);
+	  glScalef(inst.scale, inst.scale, inst.scale);
+	  glTranslatef(-center.x(), -center.y(), -center.z());
+	  glDrawElements(GL_TRIANGLES,
+			 num_tris*3,
+			 GL_UNSIGNED_INT,
+			 BUFFER_OFFSET(0));
+	  glPopMatrix();
+	  if (inst.stipple != NULL)
+	    {
+	      glDisable(GL_POLYGON_STIPPLE);
+	    }
+	}
+
+      glDisableClientState(GL_NORMAL_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+
+  HandleGLError("leaving draw mesh instanced");
+}
+
 void Mesh::drawGndVBOs() {
   // draw the ground
   HandleGLError("Before drawing ground");
@@ -4,6 +4,7 @@
 #include <vector>
 #include "vectors.h"
 #include "hash.h"
+#include "objectpool.h"
 #include "material.h"
 
 class Vertex;
@@ -73,8 +74,30 @@ struct VBOTex {
   VBOTex(float u, float v) : s(u),t(v) {}
   float s,t;
 };
+
+// placement of one copy of the mesh when drawing many of them at once
+struct MeshInstance {
+  MeshInstance() {}
+  MeshInstance(const Vec3f &p, float s, const GLubyte *st = NULL) {
+    x = p.x(); y = p.y(); z = p.z();
+    scale = s;
+    stipple = st;
+  }
+  float x, y, z;          // where the mesh center ends up
+  float scale;            // uniform scale
+  const GLubyte *stipple; // polygon stipple mask, NULL to draw solid
+};
   
 
+// one simplified copy of the mesh, with a VBO set per material
+struct MeshLOD {
+  float ratio;
+  std::vector<unsigned int> num_tris;
+  std::vector<GLuint> tri_verts_VBO;
+  std::vector<GLuint> tri_indices_VBO;
+  std::vector<GLuint> tri_texcoords_VBO;
+};
+
 class Mesh
 {
  public:
@@ -111,12 +134,15 @@ class Mesh
   // =====
   // OTHER
   int numMaterials() const {return materials.size();}
+  // level 0 is the full mesh, the rest are from setupLODVBOs
+  int numLODs() const {return lods.size() + 1;}
 
   // ===+=====
   // RENDERING
   void initializeVBOs();
   void setupVBOs();
   void drawVBOs();
+  void drawVBOsInstanced(const std::vector<MeshInstance> &instances, const Vec3f &center, int lod = 0);
   void drawGndVBOs();
   void cleanupVBOs();
 
@@ -124,6 +150,7 @@ class Mesh
   // helper functions
   void setupTriVBOs(int mat);
   void setupGndTriVBOs();
+  void setupLODVBOs();
   
   // ==============
   // REPRESENTATION
@@ -134,11 +161,18 @@ class Mesh
   std::vector<edgeshashtype> edges;
   std::vector<Material*> materials;
   std::vector<triangleshashtype> triangles;
+  //The mesh elements themselves, freed all together with the mesh
+  ObjectPool<Vertex> vertex_pool;
+  ObjectPool<Edge> edge_pool;
+  ObjectPool<Triangle> triangle_pool;
 
   std::vector<GLuint> mesh_tri_verts_VBO;
   std::vector<GLuint> mesh_tri_indices_VBO;
   std::vector<GLuint> mesh_tri_texcoords_VBO;
 
+  //Simplified versions of the mesh, from most to least detailed
+  std::vector<MeshLOD> lods;
+
   //Ground representation
   std::vector<Vertex*> g_vertices;
   edgeshashtype g_edges;
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cassert>
+
+#include "meshsimplifier.h"
+
+// =======================================================================
+// QUADRICS
+// =======================================================================
+
+// accumulate the squared distance to the plane ax + by + cz + d = 0
+void MeshSimplifier::Quadric::addPlane(double a, double b, double c, double d, double w) {
+  m[0] += w*a*a; m[1] += w*a*b; m[2] += w*a*c; m[3] += w*a*d;
+  m[4] += w*b*b; m[5] += w*b*c; m[6] += w*b*d;
+  m[7] += w*c*c; m[8] += w*c*d;
+  m[9] += w*d*d;
+}
+
+double MeshSimplifier::Quadric::evaluate(const Vec3f &p) const {
+  double x = p.x(), y = p.y(), z = p.z();
+  return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x
+    + m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y
+    + m[7]*z*z + 2*m[8]*z
+    + m[9];
+}
+
+// =======================================================================
+// CONSTRUCTOR
+// =======================================================================
+
+MeshSimplifier::MeshSimplifier(const std::vector<Vec3f> &positions_,
+                               const std::vector<SimplifierTri> &triangles_,
+                               const std::vector<bool> &locked_) :
+  positions(positions_), triangles(triangles_), locked(locked_) {
+  assert (locked.size() == positions.size());
+  int num_verts = positions.size();
+  int num_tris = triangles.size();
+
+  tri_alive = std::vector<bool>(num_tris, true);
+  vert_alive = std::vector<bool>(num_verts, true);
+  vert_version = std::vector<int>(num_verts, 0);
+  quadrics = std::vector<Quadric>(num_verts);
+  vert_tris = std::vector<std::vector<int> >(num_verts);
+  num_alive = num_tris;
+
+  // every vertex starts with the area weighted planes of its triangles
+  for (int i = 0; i < num_tris; i++) {
+    const SimplifierTri &t = triangles[i];
+    Vec3f a = positions[t.verts[0]];
+    Vec3f b = positions[t.verts[1]];
+    Vec3f c = positions[t.verts[2]];
+    Vec3f normal;
+    Vec3f::Cross3(normal, b-a, c-a);
+    double area = normal.Length() * 0.5;
+    normal.Normalize();
+    double d = -normal.Dot3(a);
+    for (int j = 0; j < 3; j++) {
+      quadrics[t.verts[j]].addPlane(normal.x(), normal.y(), normal.z(), d, area);
+      vert_tris[t.verts[j]].push_back(i);
+    }
+  }
+}
+
+// =======================================================================
+// SIMPLIFY
+// =======================================================================
+
+std::vector<std::vector<SimplifierTri> > MeshSimplifier::simplify(const std::vector<float> &ratios) {
+  std::vector<std::vector<SimplifierTri> > answer;
+  int initial = triangles.size();
+
+  // start with every edge in both directions
+  std::vector<Collapse> heap;
+  std::vector<int> n;
+  for (unsigned int v = 0; v < positions.size(); v++) {
+    neighbors(v, n);
+    for (unsigned int i = 0; i < n.size(); i++) {
+      pushCollapse(v, n[i], heap);
+    }
+  }
+
+  for (unsigned int r = 0; r < ratios.size(); r++) {
+    assert (r == 0 || ratios[r] <= ratios[r-1]);
+    int target = int(ratios[r] * initial);
+    while (num_alive > target && !heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end());
+      Collapse c = heap.back();
+      heap.pop_back();
+      // skip collapses computed before either vertex last changed
+      if (!vert_alive[c.from] || !vert_alive[c.to]) continue;
+      if (vert_version[c.from] != c.from_version || vert_version[c.to] != c.to_version) continue;
+      if (!canCollapse(c.from, c.to)) continue;
+      doCollapse(c.from, c.to);
+      pushCollapses(c.to, heap);
+    }
+    answer.push_back(liveTriangles());
+  }
+  return answer;
+}
+
+// =======================================================================
+// HELPER FUNCTIONS
+// =======================================================================
+
+// queue every collapse that involves v, in both directions
+void MeshSimplifier::pushCollapses(int v, std::vector<Collapse> &heap) {
+  std::vector<int> n;
+  neighbors(v, n);
+  for (unsigned int i = 0; i < n.size(); i++) {
+    pushCollapse(v, n[i], heap);
+    pushCollapse(n[i], v, heap);
+  }
+}
+
+void MeshSimplifier::pushCollapse(int from, int to, std::vector<Collapse> &heap) {
+  if (locked[from]) return;
+  Quadric q = quadrics[from];
+  q += quadrics[to];
+  heap.push_back(Collapse(q.evaluate(positions[to]), from, to,
+                          vert_version[from], vert_version[to]));
+  std::push_heap(heap.begin(), heap.end());
+}
+
+// a collapse is allowed if it keeps the surface manifold and does not
+// flip any of the triangles that get stretched
+bool MeshSimplifier::canCollapse(int from, int to) const {
+  if (from == to || locked[from]) return false;
+
+  // the edge itself must still exist
+  bool shared = false;
+  const std::vector<int> &tris = vert_tris[from];
+  for (unsigned int i = 0; i < tris.size(); i++) {
+    if (tri_alive[tris[i]] && hasVertex(tris[i], to)) { shared = true; break; }
+  }
+  if (!shared) return false;
+
+  // link condition: the endpoints may only share the (at most two)
+  // vertices opposite the edge
+  std::vector<int> nf, nt;
+  neighbors(from, nf);
+  neighbors(to, nt);
+  int common = 0;
+  for (unsigned int i = 0; i < nf.size(); i++) {
+    if (std::find(nt.begin(), nt.end(), nf[i]) != nt.end()) common++;
+  }
+  if (common > 2) return false;
+
+  // no triangle may turn over or collapse to a sliver
+  for (unsigned int i = 0; i < tris.size(); i++) {
+    int tri = tris[i];
+    if (!tri_alive[tri] || hasVertex(tri, to)) continue;
+    Vec3f before[3], after[3];
+    for (int j = 0; j < 3; j++) {
+      int v = triangles[tri].verts[j];
+      before[j] = positions[v];
+      after[j] = positions[v == from ? to : v];
+    }
+    Vec3f n0, n1;
+    Vec3f::Cross3(n0, before[1]-before[0], before[2]-before[0]);
+    Vec3f::Cross3(n1, after[1]-after[0], after[2]-after[0]);
+    if (n1.Length() < 1e-12) return false;
+    if (n0.Dot3(n1) <= 0) return false;
+  }
+  return true;
+}
+
+void MeshSimplifier::doCollapse(int from, int to) {
+  // the texture coordinates of the surviving vertex, as seen from the
+  // side of the edge that is collapsing
+  float s = 0, t = 0;
+  std::vector<int> &tris = vert_tris[from];
+  for (unsigned int i = 0; i < tris.size(); i++) {
+    if (!tri_alive[tris[i]] || !hasVertex(tris[i], to)) continue;
+    const SimplifierTri &tri = triangles[tris[i]];
+    for (int j = 0; j < 3; j++) {
+      if (tri.verts[j] == to) { s = tri.s[j]; t = tri.t[j]; }
+    }
+    break;
+  }
+
+  for (unsigned int i = 0; i < tris.size(); i++) {
+    int id = tris[i];
+    if (!tri_alive[id]) continue;
+    if (hasVertex(id, to)) {
+      // triangles along the edge disappear
+      tri_alive[id] = false;
+      num_alive--;
+      continue;
+    }
+    SimplifierTri &tri = triangles[id];
+    for (int j = 0; j < 3; j++) {
+      if (tri.verts[j] == from) {
+        tri.verts[j] = to;
+        tri.s[j] = s;
+        tri.t[j] = t;
+      }
+    }
+    vert_tris[to].push_back(id);
+  }
+
+  quadrics[to] += quadrics[from];
+  vert_alive[from] = false;
+  tris.clear();
+  vert_version[to]++;
+
+  // forget the triangles of the surviving vertex that are gone
+  std::vector<int> &remaining = vert_tris[to];
+  unsigned int k = 0;
+  for (unsigned int i = 0; i < remaining.size(); i++) {
+    if (tri_alive[remaining[i]]) remaining[k++] = remaining[i];
+  }
+  remaining.resize(k);
+}
+
+// the vertices that share a live triangle with v
+void MeshSimplifier::neighbors(int v, std::vector<int> &out) const {
+  out.clear();
+  const std::vector<int> &tris = vert_tris[v];
+  for (unsigned int i = 0; i < tris.size(); i++) {
+    if (!tri_alive[tris[i]]) continue;
+    for (int j = 0; j < 3; j++) {
+      int w = triangles[tris[i]].verts[j];
+      if (w != v && std::find(out.begin(), out.end(), w) == out.end()) out.push_back(w);
+    }
+  }
+}
+
+bool MeshSimplifier::hasVertex(int tri, int v) const {
+  const SimplifierTri &t = triangles[tri];
+  return t.verts[0] == v || t.verts[1] == v || t.verts[2] == v;
+}
+
+std::vector<SimplifierTri> MeshSimplifier::liveTriangles() const {
+  std::vector<SimplifierTri> answer;
+  answer.reserve(num_alive);
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    if (tri_alive[i]) answer.push_back(triangles[i]);
+  }
+  return answer;
+}
+
+// =======================================================================
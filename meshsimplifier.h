@@ -0,0 +1,92 @@
+#ifndef _MESH_SIMPLIFIER_H_
+#define _MESH_SIMPLIFIER_H_
+
+#include <vector>
+#include "vectors.h"
+
+// ===================================================================
+// Quadric error edge collapse simplification (Garland & Heckbert).
+//
+// Works on a plain indexed triangle list so it can be run on one
+// material group of a Mesh at a time.  Collapses are half-edge
+// collapses (one endpoint moves onto the other), so surviving vertices
+// keep their original positions and texture coordinates.  Locked
+// vertices are never moved, which is how the caller keeps boundaries,
+// texture seams and material borders intact.
+
+struct SimplifierTri {
+  SimplifierTri() {}
+  SimplifierTri(int a, int b, int c) {
+    verts[0] = a; verts[1] = b; verts[2] = c;
+    s[0] = s[1] = s[2] = 0;
+    t[0] = t[1] = t[2] = 0;
+  }
+  int verts[3];      // indices into the vertex positions
+  float s[3], t[3];  // texture coordinates at each corner
+};
+
+class MeshSimplifier {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  MeshSimplifier(const std::vector<Vec3f> &positions,
+                 const std::vector<SimplifierTri> &triangles,
+                 const std::vector<bool> &locked);
+
+  // =========
+  // SIMPLIFY
+  // Returns one triangle list per ratio, each with at most that
+  // fraction of the original triangles (or as close as the locked
+  // vertices allow).  The ratios must be in decreasing order.
+  std::vector<std::vector<SimplifierTri> > simplify(const std::vector<float> &ratios);
+
+private:
+
+  // a symmetric 4x4 matrix, upper triangle only
+  struct Quadric {
+    Quadric() { for (int i = 0; i < 10; i++) m[i] = 0; }
+    void addPlane(double a, double b, double c, double d, double w);
+    Quadric& operator+=(const Quadric &q) {
+      for (int i = 0; i < 10; i++) m[i] += q.m[i];
+      return *this; }
+    double evaluate(const Vec3f &p) const;
+    double m[10];
+  };
+
+  // a candidate collapse of vertex from onto vertex to
+  struct Collapse {
+    Collapse(double c, int f, int t, int vf, int vt) :
+      cost(c), from(f), to(t), from_version(vf), to_version(vt) {}
+    bool operator<(const Collapse &c) const { return cost > c.cost; }
+    double cost;
+    int from, to;
+    int from_version, to_version;
+  };
+
+  // helper functions
+  void pushCollapses(int v, std::vector<Collapse> &heap);
+  void pushCollapse(int from, int to, std::vector<Collapse> &heap);
+  bool canCollapse(int from, int to) const;
+  void doCollapse(int from, int to);
+  void neighbors(int v, std::vector<int> &out) const;
+  bool hasVertex(int tri, int v) const;
+  std::vector<SimplifierTri> liveTriangles() const;
+
+  // ==============
+  // REPRESENTATION
+  std::vector<Vec3f> positions;
+  std::vector<SimplifierTri> triangles;
+  std::vector<bool> locked;
+  std::vector<bool> tri_alive;
+  std::vector<bool> vert_alive;
+  std::vector<int> vert_version;
+  std::vector<Quadric> quadrics;
+  std::vector<std::vector<int> > vert_tris;
+  int num_alive;
+};
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _OBJECT_POOL_H_
+#define _OBJECT_POOL_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// ===================================================================
+// Storage for many objects of one type, carved out of large blocks
+// instead of one heap allocation each.  Objects made one after the
+// other sit next to each other in memory, and a destroyed object's
+// slot is reused by the next one made.
+//
+// When the pool goes away (or on clear()) the blocks are freed all at
+// once WITHOUT running the destructors of the objects still in it, so
+// it is only for objects that own no resources of their own, like the
+// vertices, edges and triangles of a Mesh, whose destructors do no
+// more than unlink them from each other.
+
+template <class T>
+class ObjectPool {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  ObjectPool(size_t block_size_ = 4096) :
+    block_size(block_size_), capacity(0), used(0), free_list(NULL), live(0) {
+    assert (block_size > 0);
+  }
+  ~ObjectPool() { clear(); }
+
+  // ==========
+  // ALLOCATION
+  template <class... Args>
+  T* create(Args&&... args) {
+    Slot *slot = free_list;
+    if (slot != NULL) {
+      free_list = slot->next;
+    } else {
+      if (used == capacity) addBlock(block_size);
+      slot = &blocks.back()[used++];
+    }
+    live++;
+    return new (slot->storage) T(std::forward<Args>(args)...);
+  }
+  void destroy(T *t) {
+    if (t == NULL) return;
+    assert (live > 0);
+    t->~T();
+    Slot *slot = (Slot*)t;
+    slot->next = free_list;
+    free_list = slot;
+    live--;
+  }
+
+  // make sure there is room for n more objects in one piece
+  void reserve(size_t n) {
+    if (capacity - used < n) addBlock(std::max(n, block_size));
+  }
+  // free every block, see above
+  void clear() {
+    for (unsigned int i = 0; i < blocks.size(); i++) delete [] blocks[i];
+    blocks.clear();
+    capacity = used = 0;
+    free_list = NULL;
+    live = 0;
+  }
+
+  size_t size() const { return live; }
+
+private:
+
+  // an object, or the link to the next free slot once it is destroyed
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  void addBlock(size_t n) {
+    // what is left of the current block is abandoned
+    blocks.push_back(new Slot[n]);
+    capacity = n;
+    used = 0;
+  }
+
+  // don't copy pools, the objects point into them
+  ObjectPool(const ObjectPool&);
+  ObjectPool& operator=(const ObjectPool&);
+
+  // ==============
+  // REPRESENTATION
+  std::vector<Slot*> blocks;
+  size_t block_size;
+  // the size of the last block, and the slots taken in it
+  size_t capacity;
+  size_t used;
+  Slot *free_list;
+  size_t live;
+};
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "occlusionculler.h"
+
+// =======================================================================
+// CONSTRUCTOR
+// =======================================================================
+
+OcclusionCuller::OcclusionCuller(int width_, int height_) :
+  width(width_), height(height_) {
+  // powers of two for the pyramid, and whole groups of 4 for the rasterizer
+  assert (width >= 4 && (width & (width-1)) == 0);
+  assert (height >= 1 && (height & (height-1)) == 0);
+  for (int i = 0; i < 16; i++) mvp[i] = (i % 5 == 0) ? 1 : 0;
+}
+
+// =======================================================================
+// OCCLUDERS
+// =======================================================================
+
+void OcclusionCuller::setTerrain(const std::vector<std::vector<float> > &heights, float spacing, int stride) {
+  assert (stride >= 1);
+  int samples = heights.size();
+  int n = (samples - 1 + stride - 1) / stride + 1;
+
+  occluder_verts.clear();
+  occluder_tris.clear();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      int si = std::min(i*stride, samples-1);
+      int sj = std::min(j*stride, samples-1);
+      // the lowest sample within a stride of this one
+      float h = FLT_MAX;
+      for (int a = std::max(0, si-stride+1); a <= std::min(samples-1, si+stride-1); a++) {
+        for (int b = std::max(0, sj-stride+1); b <= std::min(samples-1, sj+stride-1); b++) {
+          h = std::min(h, heights[a][b]);
+        }
+      }
+      occluder_verts.push_back(Vec3f(si*spacing, h, sj*spacing));
+    }
+  }
+  for (int i = 0; i+1 < n; i++) {
+    for (int j = 0; j+1 < n; j++) {
+      int a = i*n + j;
+      int b = (i+1)*n + j+1;
+      int c = (i+1)*n + j;
+      int d = i*n + j+1;
+      occluder_tris.push_back(a); occluder_tris.push_back(b); occluder_tris.push_back(c);
+      occluder_tris.push_back(b); occluder_tris.push_back(a); occluder_tris.push_back(d);
+    }
+  }
+}
+
+// =======================================================================
+// RENDERING
+// =======================================================================
+
+void OcclusionCuller::render(const float modelview[16], const float projection[16]) {
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      float sum = 0;
+      for (int k = 0; k < 4; k++) sum += projection[k*4+r] * modelview[c*4+k];
+      mvp[c*4+r] = sum;
+    }
+  }
+
+  levels.resize(1);
+  levels[0].assign(width*height, 1.0f);
+
+  std::vector<float> clip(occluder_verts.size()*4);
+  for (unsigned int i = 0; i < occluder_verts.size(); i++) {
+    transform(occluder_verts[i], &clip[4*i]);
+  }
+  for (unsigned int i = 0; i < occluder_tris.size(); i += 3) {
+    clipAndRasterize(&clip[4*occluder_tris[i]], &clip[4*occluder_tris[i+1]], &clip[4*occluder_tris[i+2]]);
+  }
+  buildPyramid();
+}
+
+void OcclusionCuller::transform(const Vec3f &p, float out[4]) const {
+  for (int r = 0; r < 4; r++) {
+    out[r] = mvp[r]*p.x() + mvp[4+r]*p.y() + mvp[8+r]*p.z() + mvp[12+r];
+  }
+}
+
+// cut the triangle at the near plane (z = -w in clip space), then
+// project what is left to the screen
+void OcclusionCuller::clipAndRasterize(const float a[4], const float b[4], const float c[4]) {
+  const float *in[3] = { a, b, c };
+  float poly[4][4];
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    const float *p = in[i];
+    const float *q = in[(i+1)%3];
+    float dp = p[2] + p[3];
+    float dq = q[2] + q[3];
+    if (dp >= 0) {
+      for (int k = 0; k < 4; k++) poly[count][k] = p[k];
+      count++;
+    }
+    if ((dp >= 0) != (dq >= 0)) {
+      float t = dp / (dp - dq);
+      for (int k = 0; k < 4; k++) poly[count][k] = p[k] + t*(q[k]-p[k]);
+      count++;
+    }
+  }
+  if (count < 3) return;
+
+  float screen[4][3];
+  for (int i = 0; i < count; i++) {
+    float w = std::max(poly[i][3], 1e-6f);
+    screen[i][0] = (poly[i][0]/w * 0.5f + 0.5f) * width;
+    screen[i][1] = (poly[i][1]/w * 0.5f + 0.5f) * height;
+    screen[i][2] = poly[i][2]/w * 0.5f + 0.5f;
+  }
+  for (int i = 1; i+1 < count; i++) {
+    rasterizeTriangle(screen[0], screen[i], screen[i+1]);
+  }
+}
+
+// keep the nearest depth at every pixel center inside the triangle
+void OcclusionCuller::rasterizeTriangle(const float a_[3], const float b_[3], const float c_[3]) {
+  const float *a = a_, *b = b_, *c = c_;
+  float area = (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+  if (fabs(area) < 1e-8) return;
+  // both sides of the terrain hide things
+  if (area < 0) { std::swap(b, c); area = -area; }
+
+  int minx = std::max(0, (int)floor(std::min(a[0], std::min(b[0], c[0]))));
+  int maxx = std::min(width-1, (int)ceil(std::max(a[0], std::max(b[0], c[0]))));
+  int miny = std::max(0, (int)floor(std::min(a[1], std::min(b[1], c[1]))));
+  int maxy = std::min(height-1, (int)ceil(std::max(a[1], std::max(b[1], c[1]))));
+  if (minx > maxx || miny > maxy) return;
+
+  // edge functions E = A*x + B*y + C, positive inside, for the edges
+  // opposite a, b and c; each one over the area is that vertex's weight
+  const float *from[3] = { b, c, a };
+  const float *to[3] = { c, a, b };
+  float A[3], B[3], C[3];
+  for (int e = 0; e < 3; e++) {
+    A[e] = -(to[e][1] - from[e][1]);
+    B[e] = to[e][0] - from[e][0];
+    C[e] = -B[e]*from[e][1] - A[e]*from[e][0];
+  }
+  // depth is linear across the screen too
+  float ZA = (a[2]*A[0] + b[2]*A[1] + c[2]*A[2]) / area;
+  float ZB = (a[2]*B[0] + b[2]*B[1] + c[2]*B[2]) / area;
+  float ZC = (a[2]*C[0] + b[2]*C[1] + c[2]*C[2]) / area;
+
+  // whole groups of 4 pixels; the edge functions reject the extra ones
+  minx &= ~3;
+  for (int y = miny; y <= maxy; y++) {
+    float py = y + 0.5f;
+    float *row = &levels[0][y*width];
+#ifdef __SSE2__
+    __m128 zero = _mm_setzero_ps();
+    __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    for (int x = minx; x <= maxx; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int e = 0; e < 3; e++) {
+        __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[e]), px), _mm_set1_ps(B[e]*py + C[e]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+      }
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ZA), px), _mm_set1_ps(ZB*py + ZC));
+      __m128 old = _mm_loadu_ps(row + x);
+      __m128 nearer = _mm_min_ps(old, z);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+    }
+#else
+    for (int x = minx; x <= maxx; x++) {
+      float px = x + 0.5f;
+      if (A[0]*px + B[0]*py + C[0] < 0) continue;
+      if (A[1]*px + B[1]*py + C[1] < 0) continue;
+      if (A[2]*px + B[2]*py + C[2] < 0) continue;
+      float z = ZA*px + ZB*py + ZC;
+      if (z < row[x]) row[x] = z;
+    }
+#endif
+  }
+}
+
+// each level keeps the farthest depth of the 2x2 texels below it
+void OcclusionCuller::buildPyramid() {
+  int w = width, h = height;
+  while (w > 1 || h > 1) {
+    int w2 = std::max(1, w/2);
+    int h2 = std::max(1, h/2);
+    const std::vector<float> &src = levels.back();
+    std::vector<float> dst(w2*h2);
+    for (int y = 0; y < h2; y++) {
+      int y0 = std::min(2*y, h-1), y1 = std::min(2*y+1, h-1);
+      for (int x = 0; x < w2; x++) {
+        int x0 = std::min(2*x, w-1), x1 = std::min(2*x+1, w-1);
+        dst[y*w2+x] = std::max(std::max(src[y0*w+x0], src[y0*w+x1]),
+                               std::max(src[y1*w+x0], src[y1*w+x1]));
+      }
+    }
+    levels.push_back(dst);
+    w = w2;
+    h = h2;
+  }
+}
+
+// =======================================================================
+// QUERIES
+// =======================================================================
+
+bool OcclusionCuller::isOccluded(const Vec3f &lo, const Vec3f &hi) const {
+  if (levels.empty()) return false;
+
+  // the screen rectangle and nearest depth of the box
+  float minx = FLT_MAX, maxx = -FLT_MAX, miny = FLT_MAX, maxy = -FLT_MAX;
+  float nearest = FLT_MAX;
+  for (int i = 0; i < 8; i++) {
+    Vec3f corner((i & 1) ? hi.x() : lo.x(), (i & 2) ? hi.y() : lo.y(), (i & 4) ? hi.z() : lo.z());
+    float p[4];
+    transform(corner, p);
+    if (p[3] <= 0 || p[2] < -p[3]) return false;
+    float sx = (p[0]/p[3] * 0.5f + 0.5f) * width;
+    float sy = (p[1]/p[3] * 0.5f + 0.5f) * height;
+    minx = std::min(minx, sx); maxx = std::max(maxx, sx);
+    miny = std::min(miny, sy); maxy = std::max(maxy, sy);
+    nearest = std::min(nearest, p[2]/p[3] * 0.5f + 0.5f);
+  }
+
+  // a texel of margin, and nothing can be said about what is off screen
+  int x0 = (int)floor(minx) - 1, x1 = (int)floor(maxx) + 1;
+  int y0 = (int)floor(miny) - 1, y1 = (int)floor(maxy) + 1;
+  if (x0 < 0 || y0 < 0 || x1 >= width || y1 >= height) return false;
+
+  // the first level where the rectangle covers at most 2x2 texels
+  int level = 0;
+  while (level+1 < (int)levels.size() &&
+         ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+    level++;
+  }
+  int w = std::max(1, width >> level);
+  const std::vector<float> &depth = levels[level];
+  float farthest = 0;
+  for (int y = y0 >> level; y <= (y1 >> level); y++) {
+    for (int x = x0 >> level; x <= (x1 >> level); x++) {
+      farthest = std::max(farthest, depth[y*w + x]);
+    }
+  }
+  return nearest > farthest;
+}
+
+// =======================================================================
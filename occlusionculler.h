@@ -0,0 +1,71 @@
+#ifndef _OCCLUSION_CULLER_H_
+#define _OCCLUSION_CULLER_H_
+
+#include <vector>
+#include "vectors.h"
+
+// ===================================================================
+// Software occlusion culling against the terrain.
+//
+// The terrain heightfield is rasterized on the CPU into a small depth
+// buffer (4 pixels at a time with SSE2 where available), from which a
+// hierarchical-Z pyramid is built where every texel holds the farthest
+// depth of the texels below it.  A bounding box is hidden if its
+// nearest point is behind the farthest occluder over the whole screen
+// rectangle it covers, which takes a handful of pyramid reads.
+//
+// The test is conservative: anything that is not fully on screen, or
+// that reaches the near plane, counts as visible, and the tested
+// rectangle is grown by a texel to cover the rounding of the coarse
+// rasterization.
+
+class OcclusionCuller {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  // The size of the depth buffer, both powers of two
+  OcclusionCuller(int width = 128, int height = 128);
+
+  // =========
+  // OCCLUDERS
+  // A square heightfield of (n+1)x(n+1) samples, spacing apart, with
+  // heights[i][j] at (i*spacing, heights[i][j], j*spacing).  With a
+  // stride over 1 only every stride-th sample is kept, at the lowest
+  // height around it, so the coarse surface stays under the real one.
+  void setTerrain(const std::vector<std::vector<float> > &heights, float spacing, int stride = 1);
+
+  // ==========
+  // RENDERING
+  // Rasterize the occluders as seen through these matrices (column
+  // major, as returned by glGetFloatv) and build the pyramid
+  void render(const float modelview[16], const float projection[16]);
+
+  // =======
+  // QUERIES
+  bool isOccluded(const Vec3f &lo, const Vec3f &hi) const;
+
+private:
+
+  // helper functions
+  void transform(const Vec3f &p, float out[4]) const;
+  void clipAndRasterize(const float a[4], const float b[4], const float c[4]);
+  void rasterizeTriangle(const float a[3], const float b[3], const float c[3]);
+  void buildPyramid();
+
+  // ==============
+  // REPRESENTATION
+  int width;
+  int height;
+  std::vector<Vec3f> occluder_verts;
+  std::vector<int> occluder_tris;
+  // projection * modelview, column major
+  float mvp[16];
+  // level 0 is the depth buffer, each level after is half the size
+  std::vector<std::vector<float> > levels;
+};
+
+// ===================================================================
+
+#endif
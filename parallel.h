@@ -0,0 +1,26 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <algorithm>
+#include "jobsystem.h"
+
+// ===================================================================
+// Run part(t) for every t < num_parts as jobs of GLOBAL_jobs, and wait
+// for all of them.
+
+template <class Part>
+void runParts(int num_parts, const Part &part) {
+  GLOBAL_jobs.parallelFor(0, num_parts, 1, [&part](int lo, int hi) {
+    for (int t = lo; t < hi; t++) part(t);
+  });
+}
+
+// The number of parts to split n items into, so that every part gets
+// at least min_items of them and no more parts than threads are used
+inline int numParts(int n, int min_items) {
+  return std::max(1, std::min(GLOBAL_jobs.numThreads(), n / min_items));
+}
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "qualitycontroller.h"
+
+// how quickly the smoothed frame cost follows the measurements
+static const float SMOOTHING = 0.1f;
+// over this much of the target for FRAMES_OVER frames steps down, under
+// this much for frames_to_step_up frames steps up
+static const float OVER = 1.05f;
+static const float UNDER = 0.75f;
+static const int FRAMES_OVER = 10;
+static const int MIN_FRAMES_UNDER = 30;
+static const int MAX_FRAMES_UNDER = 480;
+// frames to wait after a step, for the cost at the new level to show
+static const int COOLDOWN = 20;
+// stepping down this soon after a step up makes the next step up wait
+// twice as long
+static const int QUICK_REGRET = 120;
+
+// =======================================================================
+// CONSTRUCTOR & CLEANUP
+// =======================================================================
+
+QualityController::QualityController() :
+  target_ms(0), level(0), extra_cpu_ms(0), cpu_ms(0), gpu_ms(0), smoothed_ms(0),
+  timer_queries(false), current_query(0), query_active(false),
+  frames_over(0), frames_under(0), cooldown(0), frames_to_step_up(MIN_FRAMES_UNDER),
+  frame(0), last_step_up(-QUICK_REGRET) {
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    queries[i] = 0;
+    pending[i] = false;
+  }
+}
+
+void QualityController::initialize(float target_ms_) {
+  assert (target_ms_ >= 0);
+  target_ms = target_ms_;
+  setLevel(0);
+
+  // the frames are measured even with the controller off, for anyone
+  // else who wants to know what they cost
+  const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+  timer_queries = extensions != NULL &&
+    (strstr(extensions, "GL_ARB_timer_query") != NULL || strstr(extensions, "GL_EXT_timer_query") != NULL);
+  if (timer_queries) glGenQueries(NUM_QUERIES, queries);
+  HandleGLError("After setting up the quality controller");
+  if (!isEnabled()) return;
+  if (!timer_queries) {
+    std::cerr << "No GPU timer queries, the frame time is only measured on the CPU\n";
+  }
+  std::cout << "Quality controller: aiming for " << target_ms << " ms a frame\n";
+}
+
+void QualityController::cleanup() {
+  if (timer_queries) glDeleteQueries(NUM_QUERIES, queries);
+  timer_queries = false;
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    queries[i] = 0;
+    pending[i] = false;
+  }
+}
+
+// =======================================================================
+// FRAMES
+// =======================================================================
+
+void QualityController::beginFrame() {
+  cpu_start = Clock::now();
+  query_active = false;
+  if (!timer_queries) return;
+  // if the query from NUM_QUERIES frames ago has not come back yet,
+  // this frame goes unmeasured rather than wait for it
+  current_query = (current_query + 1) % NUM_QUERIES;
+  if (pending[current_query]) readGpuTimes();
+  if (pending[current_query]) return;
+  glBeginQuery(GL_TIME_ELAPSED, queries[current_query]);
+  query_active = true;
+}
+
+bool QualityController::endFrame() {
+  if (query_active) {
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[current_query] = true;
+    query_active = false;
+  }
+  cpu_ms = std::chrono::duration<float, std::milli>(Clock::now() - cpu_start).count() + extra_cpu_ms;
+  extra_cpu_ms = 0;
+  readGpuTimes();
+  frame++;
+  if (!isEnabled()) return false;
+  return adjust(std::max(cpu_ms, gpu_ms));
+}
+
+// Reads every query that has come back, oldest first, so that gpu_ms
+// ends up as the latest frame measured
+void QualityController::readGpuTimes() {
+  for (int k = 1; k <= NUM_QUERIES; k++) {
+    int i = (current_query + k) % NUM_QUERIES;
+    if (!pending[i]) continue;
+    GLint available = 0;
+    glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) continue;
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+    gpu_ms = elapsed / 1.0e6f;
+    pending[i] = false;
+  }
+}
+
+// =======================================================================
+// LEVELS
+// =======================================================================
+
+bool QualityController::adjust(float frame_ms) {
+  smoothed_ms = (smoothed_ms == 0) ? frame_ms : smoothed_ms + SMOOTHING * (frame_ms - smoothed_ms);
+  if (cooldown > 0) {
+    cooldown--;
+    return false;
+  }
+
+  if (smoothed_ms > target_ms * OVER) {
+    frames_over++;
+    frames_under = 0;
+  } else if (smoothed_ms < target_ms * UNDER) {
+    frames_under++;
+    frames_over = 0;
+  } else {
+    frames_over = frames_under = 0;
+  }
+
+  if (frames_over >= FRAMES_OVER && level < NUM_LEVELS - 1) {
+    if (frame - last_step_up < QUICK_REGRET) {
+      frames_to_step_up = std::min(MAX_FRAMES_UNDER, frames_to_step_up * 2);
+    } else {
+      frames_to_step_up = MIN_FRAMES_UNDER;
+    }
+    setLevel(level + 1);
+    return true;
+  }
+  if (frames_under >= frames_to_step_up && level > 0) {
+    last_step_up = frame;
+    setLevel(level - 1);
+    return true;
+  }
+  return false;
+}
+
+// 0 before level first, 1 from level last on, and in between linearly
+static float ramp(int level, int first, int last) {
+  return std::min(1.0f, std::max(0.0f, (level - first) / float(last - first)));
+}
+
+void QualityController::setLevel(int l) {
+  assert (l >= 0 && l < NUM_LEVELS);
+  bool changed = (l != level);
+  level = l;
+  // the knobs overlap a little, so no single step is a big jump
+  settings.impostor_bias = 1.5f * ramp(level, 0, 3);
+  settings.mesh_scale = 1 - 0.75f * ramp(level, 2, 7);
+  settings.cluster_scale = 1 - 0.65f * ramp(level, 5, 10);
+  settings.tree_density = 1 - 0.5f * ramp(level, 8, NUM_LEVELS - 1);
+  frames_over = frames_under = 0;
+  cooldown = COOLDOWN;
+  if (changed) {
+    std::cout << "Quality level " << level << " of " << NUM_LEVELS - 1
+              << " (" << smoothed_ms << " ms a frame, CPU " << cpu_ms
+              << " GPU " << gpu_ms << ")\n";
+  }
+}
+
+// =======================================================================
@@ -0,0 +1,126 @@
+#ifndef _QUALITY_CONTROLLER_H_
+#define _QUALITY_CONTROLLER_H_
+
+#include <chrono>
+
+#include "glCanvas.h"
+
+// ===================================================================
+// How much of the quality asked for on the command line to draw with.
+// The scales multiply -mesh_distance, -mesh_budget and
+// -cluster_distance; tree_density is the part of the impostor trees
+// that are drawn, and impostor_bias is added to the mip level the
+// impostors are read from.
+
+struct QualitySettings {
+  QualitySettings() :
+    mesh_scale(1), cluster_scale(1), tree_density(1), impostor_bias(0) {}
+  float mesh_scale;
+  float cluster_scale;
+  float tree_density;
+  float impostor_bias;
+};
+
+// ===================================================================
+// Keeps the frame time near a target by stepping the quality down
+// when frames take too long and back up when there is time to spare.
+//
+// A frame costs whichever is slower of the CPU and the GPU.  The CPU
+// time is the time spent between beginFrame() and endFrame(), plus
+// whatever else is handed to addCpuTime(); the GPU time comes from a
+// GL_TIME_ELAPSED query, read a few frames later so the CPU never
+// waits for it.  Without timer queries only the CPU is measured.
+//
+// The cost is smoothed, and the level only moves after the frames
+// have been over (or well under) the target for a while, with a pause
+// after every step.  Stepping up waits longer each time it had to be
+// taken back soon after, so the level settles instead of going back
+// and forth across the target.
+//
+// The levels give up the cheapest looking knobs first: blurrier
+// impostors, then fewer and closer meshes, then closer far-field
+// clusters, and last thinner impostor trees.
+
+class QualityController {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  QualityController();
+  ~QualityController() { cleanup(); }
+
+  // needs the GL context.  A target of 0 ms turns the controller off,
+  // and the quality stays at the full level (the frames are still
+  // measured).
+  void initialize(float target_ms);
+  void cleanup();
+
+  // =========
+  // ACCESSORS
+  bool isEnabled() const { return target_ms > 0; }
+  int getLevel() const { return level; }
+  const QualitySettings& getSettings() const { return settings; }
+  // the last measured, and the smoothed frame cost, in ms
+  float getCpuMs() const { return cpu_ms; }
+  float getGpuMs() const { return gpu_ms; }
+  float getFrameMs() const { return smoothed_ms; }
+
+  // =======
+  // FRAMES
+  // around the drawing of a frame; endFrame returns true if the
+  // settings changed
+  void beginFrame();
+  bool endFrame();
+  // CPU work for the next frame done outside of it
+  void addCpuTime(float ms) { extra_cpu_ms += ms; }
+  // pick up the GPU times that have come back; after a glFinish that is
+  // every frame so far, and getGpuMs() is the last one
+  void readGpuTimes();
+
+  static const int NUM_LEVELS = 13;
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  // helper functions
+  bool adjust(float frame_ms);
+  void setLevel(int l);
+
+  // ==============
+  // REPRESENTATION
+  float target_ms;
+  int level;
+  QualitySettings settings;
+
+  // measurements
+  Clock::time_point cpu_start;
+  float extra_cpu_ms;
+  float cpu_ms;
+  float gpu_ms;
+  float smoothed_ms;
+
+  // the GL_TIME_ELAPSED queries, used round robin; a query is pending
+  // until its result has been read
+  static const int NUM_QUERIES = 4;
+  bool timer_queries;
+  GLuint queries[NUM_QUERIES];
+  bool pending[NUM_QUERIES];
+  int current_query;
+  bool query_active;
+
+  // hysteresis: how many frames in a row have been over or under the
+  // target, the frames to wait after a step, how many frames under
+  // the target it takes to step up, and when the last step up was
+  int frames_over;
+  int frames_under;
+  int cooldown;
+  int frames_to_step_up;
+  int frame;
+  int last_step_up;
+};
+
+// ===================================================================
+
+#endif
@@ -7,10 +7,13 @@
 //
 
 #include "seeder.h"
-#include "utils.h"
+#include "counterrng.h"
+#include "ecology.h"
+#include "jobsystem.h"
 
 #include "mesh.h"
 
+#include <cassert>
 #include <cmath>
 #include <iostream>
 
@@ -36,12 +39,22 @@ std::vector<int> Seeder::getPoissonDistribution(int numBlocks)
   int maxK = 10;
   int i = 0;
   std::vector<int> pointsPerBlock;
+  std::vector<float> lambdas (numBlocks, m_lambda);
+  std::vector<double> draws (numBlocks);
   
+  //  Fewer trees where the density map says so
+  if (m_densitySamples > 0) {
+    assert((m_densitySamples - 1) * (m_densitySamples - 1) == numBlocks);
+    lambdas = EcologyRules::blockLambdas(m_density, m_densitySamples, m_lambda);
+  }
+
+  //  One number per block, by its index
+  GLOBAL_rng.fillExc(RNG_TREE_COUNTS, 0, 0, &draws[0], numBlocks);
   for (int a = 0; a < numBlocks; ++a) {
-    rand = GLOBAL_mtrand.rand();
+    rand = draws[a];
     sum = 0;
     for (i = 0; i < maxK; ++i) {
-      sum += pow(m_lambda, i)*exp(-m_lambda) / factorial[i];
+      sum += pow(lambdas[a], i)*exp(-lambdas[a]) / factorial[i];
       
       if (sum > rand) {
         break;
@@ -56,28 +69,195 @@ std::vector<int> Seeder::getPoissonDistribution(int numBlocks)
 std::vector<std::vector<Vec3f> > Seeder::getTreeLocations(float area, int numBlocks, float treeSize)
 {
   //  The scene's ground
-  float blockSideLength, randOffset1, randOffset2;
-  int numTrees;
+  float blockSideLength;
   std::vector<int> pointsPerBlock;
-  Vec3f intraCellOffset;
   
   blockSideLength = sqrt(area / numBlocks);
   std::vector<std::vector<Vec3f> > locations (numBlocks);
   
   pointsPerBlock = this->getPoissonDistribution(numBlocks);
   
-  //  Distribute trees at n per block
-  for (int i = 0; i < numBlocks; ++i) {
-    numTrees = pointsPerBlock[i];
-    for (int j = 0; j < numTrees; ++j) {
-      randOffset1 = (GLOBAL_mtrand.rand() + 0.5);
-      randOffset2 = (GLOBAL_mtrand.rand() + 0.5);
-      intraCellOffset = Vec3f(randOffset1 * blockSideLength / numTrees, 0, randOffset2 * blockSideLength / numTrees) 
-                        + (j / (int)m_lambda)*Vec3f(randOffset1 * blockSideLength / numTrees,0,randOffset2 * blockSideLength / (numTrees*2))
-                        + (j % (int)m_lambda)*Vec3f(randOffset2 * blockSideLength / (numTrees*2),0,randOffset1 * blockSideLength / numTrees);
-      locations[i].push_back(intraCellOffset);
+  //  Distribute trees at n per block.  Every block draws from its own
+  //  stream, so the blocks can be filled in parallel.
+  GLOBAL_jobs.parallelFor(0, numBlocks, 16, [&](int lo, int hi) {
+    float randOffset1, randOffset2;
+    Vec3f intraCellOffset;
+    for (int i = lo; i < hi; ++i) {
+      int numTrees = pointsPerBlock[i];
+      for (int j = 0; j < numTrees; ++j) {
+        randOffset1 = (GLOBAL_rng.rand(RNG_TREE_LATTICE, i, 2*j) + 0.5);
+        randOffset2 = (GLOBAL_rng.rand(RNG_TREE_LATTICE, i, 2*j+1) + 0.5);
+        intraCellOffset = Vec3f(randOffset1 * blockSideLength / numTrees, 0, randOffset2 * blockSideLength / numTrees) 
+                          + (j / (int)m_lambda)*Vec3f(randOffset1 * blockSideLength / numTrees,0,randOffset2 * blockSideLength / (numTrees*2))
+                          + (j % (int)m_lambda)*Vec3f(randOffset2 * blockSideLength / (numTrees*2),0,randOffset1 * blockSideLength / numTrees);
+        locations[i].push_back(intraCellOffset);
+      }
     }
-  }
+  });
   
   return locations;
 }
+
+//  The density map, bilinearly interpolated between the block corners
+float Seeder::densityAt(float x, float z, float blockSideLength) const
+{
+  if (m_densitySamples == 0) return 1;
+  int n = m_densitySamples;
+  float fx = std::min(std::max(x / blockSideLength, 0.0f), n - 1.0f);
+  float fz = std::min(std::max(z / blockSideLength, 0.0f), n - 1.0f);
+  int i = std::min((int)fx, n - 2);
+  int j = std::min((int)fz, n - 2);
+  fx -= i;
+  fz -= j;
+  return (1 - fx) * ((1 - fz) * m_density[i*n + j] + fz * m_density[i*n + j+1])
+    + fx * ((1 - fz) * m_density[(i+1)*n + j] + fz * m_density[(i+1)*n + j+1]);
+}
+
+//  The square being filled, cut into tiles for the threads, and a grid
+//  of cells small enough to hold at most one tree each
+struct PoissonDiskGrid {
+  float side;
+  float minSpacing;
+  float cellSize;
+  int cellsPerSide;
+  int cellsPerTile;
+  int tilesPerSide;
+  //  The tree in each cell, if any, and whether it is kept
+  std::vector<float> x, z;
+  std::vector<char> used;
+  std::vector<char> kept;
+  //  The density of each cell, the chance of keeping its tree
+  std::vector<float> density;
+};
+
+//  True if there is no tree within the minimum spacing of (px, pz)
+static bool isFree(const PoissonDiskGrid &g, float px, float pz)
+{
+  int cx = px / g.cellSize;
+  int cz = pz / g.cellSize;
+  //  A cell is minSpacing / sqrt(2) wide, so two cells out is far enough
+  for (int i = std::max(0, cx - 2); i <= std::min(g.cellsPerSide - 1, cx + 2); ++i) {
+    for (int j = std::max(0, cz - 2); j <= std::min(g.cellsPerSide - 1, cz + 2); ++j) {
+      int c = i * g.cellsPerSide + j;
+      if (!g.used[c]) continue;
+      float dx = g.x[c] - px, dz = g.z[c] - pz;
+      if (dx*dx + dz*dz < g.minSpacing * g.minSpacing) return false;
+    }
+  }
+  return true;
+}
+
+//  Bridson's algorithm within one tile.  Trees only go in the tile's own
+//  cells, but are checked against the trees of the tiles around it.
+static void fillTile(PoissonDiskGrid &g, int tx, int tz, RandomStream &rng)
+{
+  const int tries = 30;
+  float x0 = tx * g.cellsPerTile * g.cellSize;
+  float z0 = tz * g.cellsPerTile * g.cellSize;
+  float x1 = std::min(g.side, x0 + g.cellsPerTile * g.cellSize);
+  float z1 = std::min(g.side, z0 + g.cellsPerTile * g.cellSize);
+  if (x0 >= x1 || z0 >= z1) return;
+
+  //  The trees that may still have room around them.  There is at most
+  //  one per cell, so the list fits in the worker's scratch memory.
+  ScratchArena &scratch = GLOBAL_jobs.scratch();
+  ScratchScope scope (scratch);
+  std::pair<float, float> *active = scratch.allocate<std::pair<float, float> >(g.cellsPerTile * g.cellsPerTile);
+  int numActive = 0;
+  for (int t = 0; t < tries && numActive == 0; ++t) {
+    float px = x0 + rng.randExc() * (x1 - x0);
+    float pz = z0 + rng.randExc() * (z1 - z0);
+    if (isFree(g, px, pz)) active[numActive++] = std::make_pair(px, pz);
+  }
+  if (numActive > 0) {
+    int c = int(active[0].first / g.cellSize) * g.cellsPerSide + int(active[0].second / g.cellSize);
+    g.x[c] = active[0].first;
+    g.z[c] = active[0].second;
+    g.used[c] = true;
+    g.kept[c] = rng.randExc() < g.density[c];
+  }
+
+  while (numActive > 0) {
+    int a = rng.randInt(numActive - 1);
+    bool placed = false;
+    for (int t = 0; t < tries && !placed; ++t) {
+      //  Somewhere between one and two spacings away
+      float angle = rng.randExc() * 2 * M_PI;
+      float dist = g.minSpacing * (1 + rng.randExc());
+      float px = active[a].first + cos(angle) * dist;
+      float pz = active[a].second + sin(angle) * dist;
+      if (px < x0 || px >= x1 || pz < z0 || pz >= z1) continue;
+      if (!isFree(g, px, pz)) continue;
+      int c = int(px / g.cellSize) * g.cellsPerSide + int(pz / g.cellSize);
+      g.x[c] = px;
+      g.z[c] = pz;
+      g.used[c] = true;
+      g.kept[c] = rng.randExc() < g.density[c];
+      active[numActive++] = std::make_pair(px, pz);
+      placed = true;
+    }
+    if (!placed) {
+      active[a] = active[--numActive];
+    }
+  }
+}
+
+std::vector<std::vector<Vec3f> > Seeder::getPoissonDiskLocations(float area, int numBlocks, float minSpacing)
+{
+  int sqrtNumBlocks = sqrt(numBlocks);
+  float blockSideLength = sqrt(area / numBlocks);
+
+  PoissonDiskGrid g;
+  g.side = blockSideLength * sqrtNumBlocks;
+  g.minSpacing = minSpacing;
+  g.cellSize = minSpacing / sqrt(2.0f);
+  g.cellsPerSide = (int)ceil(g.side / g.cellSize);
+  //  Tiles have to be at least minSpacing wide, see below
+  g.cellsPerTile = 8;
+  g.tilesPerSide = (g.cellsPerSide + g.cellsPerTile - 1) / g.cellsPerTile;
+  g.x = std::vector<float> (g.cellsPerSide * g.cellsPerSide, 0);
+  g.z = std::vector<float> (g.cellsPerSide * g.cellsPerSide, 0);
+  g.used = std::vector<char> (g.cellsPerSide * g.cellsPerSide, false);
+  g.kept = std::vector<char> (g.cellsPerSide * g.cellsPerSide, false);
+  g.density = std::vector<float> (g.cellsPerSide * g.cellsPerSide, 1);
+  if (m_densitySamples > 0) {
+    assert((m_densitySamples - 1) * (m_densitySamples - 1) == numBlocks);
+    for (int i = 0; i < g.cellsPerSide; ++i) {
+      for (int j = 0; j < g.cellsPerSide; ++j) {
+        g.density[i * g.cellsPerSide + j] = densityAt((i + 0.5f) * g.cellSize, (j + 0.5f) * g.cellSize, blockSideLength);
+      }
+    }
+  }
+
+  //  Tiles are filled in four passes by the parity of their coordinates.
+  //  Tiles in the same pass are a whole tile apart, more than minSpacing,
+  //  so they can neither see nor write each other's trees.
+  for (int pass = 0; pass < 4; ++pass) {
+    std::vector<std::pair<int, int> > tiles;
+    for (int tx = pass / 2; tx < g.tilesPerSide; tx += 2) {
+      for (int tz = pass % 2; tz < g.tilesPerSide; tz += 2) {
+        tiles.push_back(std::make_pair(tx, tz));
+      }
+    }
+    //  Every tile draws from its own stream, so the forest does not
+    //  depend on how the tiles are spread over threads
+    GLOBAL_jobs.parallelFor(0, tiles.size(), 4, [&](int lo, int hi) {
+      for (int k = lo; k < hi; ++k) {
+        RandomStream rng (GLOBAL_rng, RNG_TREE_POISSON, tiles[k].first * g.tilesPerSide + tiles[k].second);
+        fillTile(g, tiles[k].first, tiles[k].second, rng);
+      }
+    });
+  }
+
+  //  Hand the trees out to the blocks, in block space.  Trees thinned
+  //  out by the density map still kept the others apart, so the ones
+  //  left are as evenly spaced as before, only sparser.
+  std::vector<std::vector<Vec3f> > locations (numBlocks);
+  for (unsigned int c = 0; c < g.used.size(); ++c) {
+    if (!g.kept[c]) continue;
+    int bi = std::min(sqrtNumBlocks - 1, (int)(g.x[c] / blockSideLength));
+    int bj = std::min(sqrtNumBlocks - 1, (int)(g.z[c] / blockSideLength));
+    locations[bi * sqrtNumBlocks + bj].push_back(Vec3f(g.x[c] - bi * blockSideLength, 0, g.z[c] - bj * blockSideLength));
+  }
+  return locations;
+}
@@ -16,11 +16,24 @@
 class Seeder {
   double m_lambda;
   static const int factorial[];
+  //  How many trees grow around each block corner, 0 to 1, if set
+  std::vector<float> m_density;
+  int m_densitySamples;
   std::vector<int> getPoissonDistribution(int numBlocks);
+  float densityAt(float x, float z, float blockSideLength) const;
   
 public:
-  Seeder(double expectedNum) : m_lambda(expectedNum) {};
+  Seeder(double expectedNum) : m_lambda(expectedNum), m_densitySamples(0) {};
+
+  //  Thin the trees out by a density map with (sqrt(numBlocks)+1)^2
+  //  samples at the block corners, as from EcologyRules::densityMap
+  void setDensityMap(const std::vector<float> &density, int samplesPerSide) { m_density = density; m_densitySamples = samplesPerSide; };
   std::vector<std::vector<Vec3f> > getTreeLocations(float area, int numBlocks, float treeSize);
+
+  //  Blue noise placement (Bridson's Poisson-disk sampling): no two trees
+  //  are closer than minSpacing, and there is no room left for another.
+  //  Same block-space result as getTreeLocations.
+  std::vector<std::vector<Vec3f> > getPoissonDiskLocations(float area, int numBlocks, float minSpacing);
   
 };
 
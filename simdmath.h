@@ -0,0 +1,313 @@
+#ifndef _SIMD_MATH_H_
+#define _SIMD_MATH_H_
+
+#include <cfloat>
+#include <cmath>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SIMD_SSE 1
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#define SIMD_AVX 1
+#endif
+
+#include "vectors.h"
+
+// ===================================================================
+// Single precision vector math for the hot loops.  Vec3f and Matrix
+// are in double, which is right for the camera and the mesh code, but
+// most of what is computed per tree or per terrain sample goes to the
+// GPU as float anyway.
+//
+//   Vec4s   a point or direction in one SSE register (w is 0 for
+//           directions and 1 for points)
+//   Mat4s   a 4x4 column-major matrix of four Vec4s, like Matrix
+//   Float8  eight floats at once: one AVX register, two SSE ones, or
+//           a plain array where there is neither
+//   Vec3x8  eight Vec3s, each component in a Float8 (structure of
+//           arrays), for running a kernel over many points at once
+//
+// Everything falls back to scalar code when SSE is not available.
+
+// ===================================================================
+// FOUR FLOATS
+
+class Mat4s;
+
+class Vec4s {
+
+public:
+
+  // CONSTRUCTORS
+  Vec4s() { set(0,0,0,0); }
+  Vec4s(float x, float y, float z, float w = 0) { set(x,y,z,w); }
+  explicit Vec4s(const Vec3f &v, float w = 0) { set(v.x(),v.y(),v.z(),w); }
+
+  // ACCESSORS
+  void set(float x, float y, float z, float w) {
+#ifdef SIMD_SSE
+    v = _mm_setr_ps(x,y,z,w);
+#else
+    v[0] = x; v[1] = y; v[2] = z; v[3] = w;
+#endif
+  }
+  void get(float out[4]) const {
+#ifdef SIMD_SSE
+    _mm_storeu_ps(out, v);
+#else
+    for (int i = 0; i < 4; i++) out[i] = v[i];
+#endif
+  }
+  float operator[](int i) const { float f[4]; get(f); return f[i]; }
+  Vec3f toVec3f() const { float f[4]; get(f); return Vec3f(f[0],f[1],f[2]); }
+
+  // ARITHMETIC, component by component
+  friend Vec4s operator+(const Vec4s &a, const Vec4s &b) {
+#ifdef SIMD_SSE
+    return Vec4s(_mm_add_ps(a.v, b.v));
+#else
+    return Vec4s(a.v[0]+b.v[0], a.v[1]+b.v[1], a.v[2]+b.v[2], a.v[3]+b.v[3]);
+#endif
+  }
+  friend Vec4s operator-(const Vec4s &a, const Vec4s &b) {
+#ifdef SIMD_SSE
+    return Vec4s(_mm_sub_ps(a.v, b.v));
+#else
+    return Vec4s(a.v[0]-b.v[0], a.v[1]-b.v[1], a.v[2]-b.v[2], a.v[3]-b.v[3]);
+#endif
+  }
+  friend Vec4s operator*(const Vec4s &a, const Vec4s &b) {
+#ifdef SIMD_SSE
+    return Vec4s(_mm_mul_ps(a.v, b.v));
+#else
+    return Vec4s(a.v[0]*b.v[0], a.v[1]*b.v[1], a.v[2]*b.v[2], a.v[3]*b.v[3]);
+#endif
+  }
+  friend Vec4s operator*(const Vec4s &a, float s) { return a * Vec4s(s,s,s,s); }
+  friend Vec4s operator*(float s, const Vec4s &a) { return a * Vec4s(s,s,s,s); }
+
+  // 3D VECTOR MATH (w is ignored, and 0 in the results)
+  static float Dot3(const Vec4s &a, const Vec4s &b) {
+    float f[4]; (a * b).get(f); return f[0] + f[1] + f[2];
+  }
+  static Vec4s Cross3(const Vec4s &a, const Vec4s &b) {
+#ifdef SIMD_SSE
+    __m128 a_yzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3,0,2,1));
+    __m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3,0,2,1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.v, b_yzx), _mm_mul_ps(a_yzx, b.v));
+    // c is (z, x, y, 0) of the cross product
+    return Vec4s(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3,0,2,1)));
+#else
+    return Vec4s(a.v[1]*b.v[2] - a.v[2]*b.v[1],
+                 a.v[2]*b.v[0] - a.v[0]*b.v[2],
+                 a.v[0]*b.v[1] - a.v[1]*b.v[0], 0);
+#endif
+  }
+  float Length3() const { return sqrt(Dot3(*this, *this)); }
+  // unit length, or left alone if it is 0, as Vec3f::Normalize
+  Vec4s Normalized3() const {
+    float l = Length3();
+    return (l > 0) ? *this * (1 / l) : *this;
+  }
+
+private:
+#ifdef SIMD_SSE
+  explicit Vec4s(__m128 v_) : v(v_) {}
+#endif
+  friend class Mat4s;
+  friend Vec4s operator*(const Mat4s &m, const Vec4s &p);
+
+  // REPRESENTATION
+#ifdef SIMD_SSE
+  __m128 v;
+#else
+  float v[4];
+#endif
+};
+
+// ===================================================================
+// A 4x4 MATRIX
+
+class Mat4s {
+
+public:
+
+  // CONSTRUCTORS
+  Mat4s() { setToIdentity(); }
+  void setToIdentity() {
+    col[0] = Vec4s(1,0,0,0); col[1] = Vec4s(0,1,0,0);
+    col[2] = Vec4s(0,0,1,0); col[3] = Vec4s(0,0,0,1);
+  }
+
+  // TRANSFORMATIONS, the same as the ones of Matrix
+  static Mat4s MakeTranslation(const Vec3f &v) {
+    Mat4s m; m.col[3] = Vec4s(v, 1); return m;
+  }
+  static Mat4s MakeAxisRotation(const Vec3f &v, float theta) {
+    float x = v.x(), y = v.y(), z = v.z();
+    float c = cosf(theta), s = sinf(theta), t = 1 - c;
+    Mat4s m;
+    m.col[0] = Vec4s(t*x*x + c,   t*x*y + z*s, t*x*z - y*s, 0);
+    m.col[1] = Vec4s(t*x*y - z*s, t*y*y + c,   t*y*z + x*s, 0);
+    m.col[2] = Vec4s(t*x*z + y*s, t*y*z - x*s, t*z*z + c,   0);
+    return m;
+  }
+
+  // OPERATORS
+  friend Vec4s operator*(const Mat4s &m, const Vec4s &p) {
+    // a sum of the columns, weighted by the components of p
+#ifdef SIMD_SSE
+    __m128 r = _mm_mul_ps(m.col[0].v, _mm_shuffle_ps(p.v, p.v, _MM_SHUFFLE(0,0,0,0)));
+    r = _mm_add_ps(r, _mm_mul_ps(m.col[1].v, _mm_shuffle_ps(p.v, p.v, _MM_SHUFFLE(1,1,1,1))));
+    r = _mm_add_ps(r, _mm_mul_ps(m.col[2].v, _mm_shuffle_ps(p.v, p.v, _MM_SHUFFLE(2,2,2,2))));
+    r = _mm_add_ps(r, _mm_mul_ps(m.col[3].v, _mm_shuffle_ps(p.v, p.v, _MM_SHUFFLE(3,3,3,3))));
+    return Vec4s(r);
+#else
+    return m.col[0]*p.v[0] + m.col[1]*p.v[1] + m.col[2]*p.v[2] + m.col[3]*p.v[3];
+#endif
+  }
+  friend Mat4s operator*(const Mat4s &a, const Mat4s &b) {
+    Mat4s r;
+    for (int i = 0; i < 4; i++) r.col[i] = a * b.col[i];
+    return r;
+  }
+  Mat4s& operator*=(const Mat4s &m) { *this = *this * m; return *this; }
+
+  // Transform a point (with the perspective divide) or a direction
+  Vec3f Transform(const Vec3f &p) const {
+    float f[4]; (*this * Vec4s(p, 1)).get(f);
+    return Vec3f(f[0]/f[3], f[1]/f[3], f[2]/f[3]);
+  }
+  Vec3f TransformDirection(const Vec3f &d) const {
+    return (*this * Vec4s(d, 0)).toVec3f();
+  }
+
+private:
+  // REPRESENTATION
+  Vec4s col[4];
+};
+
+// ===================================================================
+// EIGHT FLOATS
+
+class Float8 {
+
+public:
+
+  // CONSTRUCTORS
+  Float8() {}
+  Float8(float s) {
+#if defined(SIMD_AVX)
+    v = _mm256_set1_ps(s);
+#elif defined(SIMD_SSE)
+    lo = hi = _mm_set1_ps(s);
+#else
+    for (int i = 0; i < 8; i++) v[i] = s;
+#endif
+  }
+  // 8 floats from memory (no alignment needed), and back
+  static Float8 load(const float *p) {
+    Float8 f;
+#if defined(SIMD_AVX)
+    f.v = _mm256_loadu_ps(p);
+#elif defined(SIMD_SSE)
+    f.lo = _mm_loadu_ps(p); f.hi = _mm_loadu_ps(p + 4);
+#else
+    for (int i = 0; i < 8; i++) f.v[i] = p[i];
+#endif
+    return f;
+  }
+  void store(float *p) const {
+#if defined(SIMD_AVX)
+    _mm256_storeu_ps(p, v);
+#elif defined(SIMD_SSE)
+    _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi);
+#else
+    for (int i = 0; i < 8; i++) p[i] = v[i];
+#endif
+  }
+
+  // ARITHMETIC
+#if defined(SIMD_AVX)
+#define FLOAT8_OP(name, avx, sse, op)                                  \
+  friend Float8 name(const Float8 &a, const Float8 &b) {               \
+    Float8 r; r.v = avx(a.v, b.v); return r; }
+#elif defined(SIMD_SSE)
+#define FLOAT8_OP(name, avx, sse, op)                                  \
+  friend Float8 name(const Float8 &a, const Float8 &b) {               \
+    Float8 r; r.lo = sse(a.lo, b.lo); r.hi = sse(a.hi, b.hi); return r; }
+#else
+#define FLOAT8_OP(name, avx, sse, op)                                  \
+  friend Float8 name(const Float8 &a, const Float8 &b) {               \
+    Float8 r; for (int i = 0; i < 8; i++) { float x = a.v[i], y = b.v[i]; r.v[i] = op; } return r; }
+#endif
+  FLOAT8_OP(operator+, _mm256_add_ps, _mm_add_ps, x + y)
+  FLOAT8_OP(operator-, _mm256_sub_ps, _mm_sub_ps, x - y)
+  FLOAT8_OP(operator*, _mm256_mul_ps, _mm_mul_ps, x * y)
+  FLOAT8_OP(operator/, _mm256_div_ps, _mm_div_ps, x / y)
+  // as with the SSE instructions, y if either is NaN
+  FLOAT8_OP(min, _mm256_min_ps, _mm_min_ps, (x < y) ? x : y)
+  FLOAT8_OP(max, _mm256_max_ps, _mm_max_ps, (x > y) ? x : y)
+#undef FLOAT8_OP
+
+  friend Float8 sqrt(const Float8 &a) {
+    Float8 r;
+#if defined(SIMD_AVX)
+    r.v = _mm256_sqrt_ps(a.v);
+#elif defined(SIMD_SSE)
+    r.lo = _mm_sqrt_ps(a.lo); r.hi = _mm_sqrt_ps(a.hi);
+#else
+    for (int i = 0; i < 8; i++) r.v[i] = ::sqrtf(a.v[i]);
+#endif
+    return r;
+  }
+
+private:
+  // REPRESENTATION
+#if defined(SIMD_AVX)
+  __m256 v;
+#elif defined(SIMD_SSE)
+  __m128 lo, hi;
+#else
+  float v[8];
+#endif
+};
+
+// ===================================================================
+// EIGHT 3D VECTORS
+
+struct Vec3x8 {
+
+  Vec3x8() {}
+  Vec3x8(const Float8 &x_, const Float8 &y_, const Float8 &z_) : x(x_), y(y_), z(z_) {}
+  // the same vector in all eight
+  explicit Vec3x8(const Vec3f &v) : x(v.x()), y(v.y()), z(v.z()) {}
+
+  // from and to three arrays of (at least) 8 floats
+  static Vec3x8 load(const float *xs, const float *ys, const float *zs) {
+    return Vec3x8(Float8::load(xs), Float8::load(ys), Float8::load(zs));
+  }
+  void store(float *xs, float *ys, float *zs) const {
+    x.store(xs); y.store(ys); z.store(zs);
+  }
+
+  friend Vec3x8 operator+(const Vec3x8 &a, const Vec3x8 &b) { return Vec3x8(a.x+b.x, a.y+b.y, a.z+b.z); }
+  friend Vec3x8 operator-(const Vec3x8 &a, const Vec3x8 &b) { return Vec3x8(a.x-b.x, a.y-b.y, a.z-b.z); }
+  friend Vec3x8 operator*(const Vec3x8 &a, const Float8 &s) { return Vec3x8(a.x*s, a.y*s, a.z*s); }
+  friend Vec3x8 operator*(const Float8 &s, const Vec3x8 &a) { return a * s; }
+
+  static Float8 Dot3(const Vec3x8 &a, const Vec3x8 &b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+  static Vec3x8 Cross3(const Vec3x8 &a, const Vec3x8 &b) {
+    return Vec3x8(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+  }
+  Float8 Length() const { return sqrt(Dot3(*this, *this)); }
+  // unit length; 0 stays 0, as with Vec3f::Normalize
+  Vec3x8 Normalized() const { return *this * (Float8(1) / max(Length(), Float8(FLT_MIN))); }
+
+  Float8 x, y, z;
+};
+
+// ===================================================================
+
+#endif
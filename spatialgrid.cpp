@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <queue>
+
+#include "spatialgrid.h"
+#include "parallel.h"
+
+// =======================================================================
+// CONSTRUCTOR
+// =======================================================================
+
+SpatialGrid::SpatialGrid() :
+  radius(0), origin(0,0,0), cell_size(1), side(1), levels(0) {
+  cell_start = std::vector<int>(2, 0);
+  node_ymin = std::vector<std::vector<float> >(1, std::vector<float>(1, FLT_MAX));
+  node_ymax = std::vector<std::vector<float> >(1, std::vector<float>(1, -FLT_MAX));
+}
+
+// =======================================================================
+// BUILD
+// =======================================================================
+
+void SpatialGrid::build(const std::vector<Vec3f> &points, float radius_) {
+  radius = radius_;
+  int n = points.size();
+
+  // about 4 points per cell, on a power of two grid
+  levels = 0;
+  while (levels < 10 && (1 << (2*levels)) * 4 < n) levels++;
+  side = 1 << levels;
+  int num_cells = side * side;
+
+  float lo_x = FLT_MAX, lo_z = FLT_MAX, hi_x = -FLT_MAX, hi_z = -FLT_MAX;
+  for (int i = 0; i < n; i++) {
+    lo_x = std::min(lo_x, (float)points[i].x()); hi_x = std::max(hi_x, (float)points[i].x());
+    lo_z = std::min(lo_z, (float)points[i].z()); hi_z = std::max(hi_z, (float)points[i].z());
+  }
+  if (n == 0) { lo_x = lo_z = 0; hi_x = hi_z = 1; }
+  origin = Vec3f(lo_x, 0, lo_z);
+  cell_size = std::max(std::max(hi_x - lo_x, hi_z - lo_z), 1e-3f) / side * 1.0001f;
+
+  // counting sort by cell: count each part, find where each part
+  // writes each cell, then scatter
+  int num_parts = numParts(n, 16384);
+  std::vector<int> cell(n);
+  std::vector<std::vector<int> > counts(num_parts, std::vector<int>(num_cells, 0));
+  runParts(num_parts, [&](int t) {
+      int first = (long long)n * t / num_parts;
+      int last = (long long)n * (t+1) / num_parts;
+      for (int i = first; i < last; i++) {
+        int cx = std::min(side-1, (int)((points[i].x() - origin.x()) / cell_size));
+        int cz = std::min(side-1, (int)((points[i].z() - origin.z()) / cell_size));
+        cell[i] = morton(cx, cz);
+        counts[t][cell[i]]++;
+      }
+    });
+
+  cell_start.resize(num_cells + 1);
+  int offset = 0;
+  for (int c = 0; c < num_cells; c++) {
+    cell_start[c] = offset;
+    for (int t = 0; t < num_parts; t++) {
+      int count = counts[t][c];
+      counts[t][c] = offset;
+      offset += count;
+    }
+  }
+  cell_start[num_cells] = offset;
+
+  positions.resize(n);
+  ids.resize(n);
+  runParts(num_parts, [&](int t) {
+      int first = (long long)n * t / num_parts;
+      int last = (long long)n * (t+1) / num_parts;
+      for (int i = first; i < last; i++) {
+        int slot = counts[t][cell[i]]++;
+        positions[slot] = points[i];
+        ids[slot] = i;
+      }
+    });
+
+  // height ranges, from the cells up to the root
+  node_ymin.resize(levels+1);
+  node_ymax.resize(levels+1);
+  node_ymin[0].assign(num_cells, FLT_MAX);
+  node_ymax[0].assign(num_cells, -FLT_MAX);
+  for (int c = 0; c < num_cells; c++) {
+    for (int i = cell_start[c]; i < cell_start[c+1]; i++) {
+      node_ymin[0][c] = std::min(node_ymin[0][c], (float)positions[i].y());
+      node_ymax[0][c] = std::max(node_ymax[0][c], (float)positions[i].y());
+    }
+  }
+  for (int l = 1; l <= levels; l++) {
+    int count = num_cells >> (2*l);
+    node_ymin[l].resize(count);
+    node_ymax[l].resize(count);
+    for (int i = 0; i < count; i++) {
+      node_ymin[l][i] = std::min(std::min(node_ymin[l-1][4*i], node_ymin[l-1][4*i+1]),
+                                 std::min(node_ymin[l-1][4*i+2], node_ymin[l-1][4*i+3]));
+      node_ymax[l][i] = std::max(std::max(node_ymax[l-1][4*i], node_ymax[l-1][4*i+1]),
+                                 std::max(node_ymax[l-1][4*i+2], node_ymax[l-1][4*i+3]));
+    }
+  }
+}
+
+// =======================================================================
+// QUERIES
+// =======================================================================
+
+// the squared distance from p to the box, 0 inside
+static float distanceSqr(const Vec3f &p, const Vec3f &lo, const Vec3f &hi) {
+  float d = 0;
+  for (int i = 0; i < 3; i++) {
+    float v = p[i];
+    if (v < lo[i]) d += (lo[i]-v)*(lo[i]-v);
+    else if (v > hi[i]) d += (v-hi[i])*(v-hi[i]);
+  }
+  return d;
+}
+
+void SpatialGrid::queryBox(const Vec3f &lo, const Vec3f &hi, std::vector<int> &out) const {
+  out.clear();
+  std::vector<Node> stack(1, Node(levels, 0));
+  while (!stack.empty()) {
+    Node n = stack.back();
+    stack.pop_back();
+    if (cell_start[firstCell(n)] == cell_start[lastCell(n)]) continue;
+    Vec3f nlo, nhi;
+    nodeBounds(n, nlo, nhi);
+    if (nhi.x() < lo.x() || nhi.y() < lo.y() || nhi.z() < lo.z() ||
+        nlo.x() > hi.x() || nlo.y() > hi.y() || nlo.z() > hi.z()) continue;
+    if (nlo.x() >= lo.x() && nlo.y() >= lo.y() && nlo.z() >= lo.z() &&
+        nhi.x() <= hi.x() && nhi.y() <= hi.y() && nhi.z() <= hi.z()) {
+      appendNode(n, out);
+    } else if (n.level == 0) {
+      for (int i = cell_start[firstCell(n)]; i < cell_start[lastCell(n)]; i++) {
+        if (distanceSqr(positions[i], lo, hi) <= radius*radius) out.push_back(ids[i]);
+      }
+    } else {
+      for (int c = 0; c < 4; c++) stack.push_back(Node(n.level-1, 4*n.index + c));
+    }
+  }
+}
+
+void SpatialGrid::querySphere(const Vec3f &p, float distance, std::vector<int> &out) const {
+  out.clear();
+  float d2 = distance*distance;
+  std::vector<Node> stack(1, Node(levels, 0));
+  while (!stack.empty()) {
+    Node n = stack.back();
+    stack.pop_back();
+    if (cell_start[firstCell(n)] == cell_start[lastCell(n)]) continue;
+    Vec3f lo, hi;
+    nodeBounds(n, lo, hi);
+    // the points themselves are inside the bounds by radius
+    Vec3f pad(radius, radius, radius);
+    lo += pad;
+    hi -= pad;
+    if (distanceSqr(p, lo, hi) > d2) continue;
+    // the farthest corner
+    float far2 = 0;
+    for (int i = 0; i < 3; i++) {
+      float v = std::max(fabs(p[i] - lo[i]), fabs(p[i] - hi[i]));
+      far2 += v*v;
+    }
+    if (far2 <= d2) {
+      appendNode(n, out);
+    } else if (n.level == 0) {
+      for (int i = cell_start[firstCell(n)]; i < cell_start[lastCell(n)]; i++) {
+        if ((positions[i] - p).Length() <= distance) out.push_back(ids[i]);
+      }
+    } else {
+      for (int c = 0; c < 4; c++) stack.push_back(Node(n.level-1, 4*n.index + c));
+    }
+  }
+}
+
+void SpatialGrid::queryNearest(const Vec3f &p, int k, std::vector<int> &out) const {
+  out.clear();
+  // best first: nodes by their distance to p, points by their own;
+  // a point that comes off the queue is nearer than anything left
+  struct Entry {
+    Entry(float d, int l, int i) : dist(d), level(l), index(i) {}
+    bool operator<(const Entry &e) const { return dist > e.dist; }
+    float dist;
+    int level;   // -1 for a point
+    int index;
+  };
+  std::priority_queue<Entry> queue;
+  queue.push(Entry(0, levels, 0));
+  Vec3f pad(radius, radius, radius);
+  while (!queue.empty() && (int)out.size() < k) {
+    Entry e = queue.top();
+    queue.pop();
+    if (e.level < 0) {
+      out.push_back(ids[e.index]);
+      continue;
+    }
+    Node n(e.level, e.index);
+    if (n.level == 0) {
+      for (int i = cell_start[firstCell(n)]; i < cell_start[lastCell(n)]; i++) {
+        Vec3f v = positions[i] - p;
+        queue.push(Entry(v.Dot3(v), -1, i));
+      }
+      continue;
+    }
+    for (int c = 0; c < 4; c++) {
+      Node child(n.level-1, 4*n.index + c);
+      if (cell_start[firstCell(child)] == cell_start[lastCell(child)]) continue;
+      Vec3f lo, hi;
+      nodeBounds(child, lo, hi);
+      lo += pad;
+      hi -= pad;
+      queue.push(Entry(distanceSqr(p, lo, hi), child.level, child.index));
+    }
+  }
+}
+
+void SpatialGrid::queryFrustum(const float planes[6][4], std::vector<int> &out) const {
+  out.clear();
+  std::vector<Node> stack(1, Node(levels, 0));
+  while (!stack.empty()) {
+    Node n = stack.back();
+    stack.pop_back();
+    if (cell_start[firstCell(n)] == cell_start[lastCell(n)]) continue;
+    Vec3f lo, hi;
+    nodeBounds(n, lo, hi);
+    bool outside = false, inside = true;
+    for (int i = 0; i < 6 && !outside; i++) {
+      // the corners farthest along and against the plane normal
+      const float *pl = planes[i];
+      float most = pl[3], least = pl[3];
+      for (int a = 0; a < 3; a++) {
+        most += pl[a] * (pl[a] > 0 ? hi[a] : lo[a]);
+        least += pl[a] * (pl[a] > 0 ? lo[a] : hi[a]);
+      }
+      if (most < 0) outside = true;
+      if (least < 0) inside = false;
+    }
+    if (outside) continue;
+    if (inside) {
+      appendNode(n, out);
+    } else if (n.level == 0) {
+      for (int i = cell_start[firstCell(n)]; i < cell_start[lastCell(n)]; i++) {
+        const Vec3f &q = positions[i];
+        bool keep = true;
+        for (int j = 0; j < 6 && keep; j++) {
+          keep = planes[j][0]*q.x() + planes[j][1]*q.y() + planes[j][2]*q.z() + planes[j][3] >= -radius;
+        }
+        if (keep) out.push_back(ids[i]);
+      }
+    } else {
+      for (int c = 0; c < 4; c++) stack.push_back(Node(n.level-1, 4*n.index + c));
+    }
+  }
+}
+
+void SpatialGrid::frustumPlanes(const float modelview[16], const float projection[16], float planes[6][4]) {
+  float m[16];
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      float sum = 0;
+      for (int k = 0; k < 4; k++) sum += projection[k*4+r] * modelview[c*4+k];
+      m[c*4+r] = sum;
+    }
+  }
+  // -w <= x,y,z <= w, from the rows of the matrix
+  for (int i = 0; i < 6; i++) {
+    int row = i / 2;
+    float sign = (i % 2 == 0) ? 1 : -1;
+    float length = 0;
+    for (int c = 0; c < 4; c++) {
+      planes[i][c] = m[c*4+3] + sign * m[c*4+row];
+      if (c < 3) length += planes[i][c]*planes[i][c];
+    }
+    length = sqrt(length);
+    for (int c = 0; c < 4; c++) planes[i][c] /= length;
+  }
+}
+
+// =======================================================================
+// HELPER FUNCTIONS
+// =======================================================================
+
+// the node's cells, its height range, and the radius around all of it
+void SpatialGrid::nodeBounds(const Node &n, Vec3f &lo, Vec3f &hi) const {
+  unsigned int xz = unmorton(firstCell(n));
+  float size = cell_size * (1 << n.level);
+  float x = origin.x() + (xz & 0xffff) * cell_size;
+  float z = origin.z() + (xz >> 16) * cell_size;
+  lo = Vec3f(x - radius, node_ymin[n.level][n.index] - radius, z - radius);
+  hi = Vec3f(x + size + radius, node_ymax[n.level][n.index] + radius, z + size + radius);
+}
+
+void SpatialGrid::appendNode(const Node &n, std::vector<int> &out) const {
+  out.insert(out.end(), ids.begin() + cell_start[firstCell(n)], ids.begin() + cell_start[lastCell(n)]);
+}
+
+// interleave the bits, x in the even ones and z in the odd ones
+unsigned int SpatialGrid::morton(unsigned int x, unsigned int z) {
+  unsigned int answer = 0;
+  for (int b = 0; b < 16; b++) {
+    answer |= ((x >> b) & 1) << (2*b);
+    answer |= ((z >> b) & 1) << (2*b+1);
+  }
+  return answer;
+}
+
+// x in the low 16 bits, z in the high ones
+unsigned int SpatialGrid::unmorton(unsigned int m) {
+  unsigned int x = 0, z = 0;
+  for (int b = 0; b < 16; b++) {
+    x |= ((m >> (2*b)) & 1) << b;
+    z |= ((m >> (2*b+1)) & 1) << b;
+  }
+  return x | (z << 16);
+}
+
+// =======================================================================
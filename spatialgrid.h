@@ -0,0 +1,89 @@
+#ifndef _SPATIAL_GRID_H_
+#define _SPATIAL_GRID_H_
+
+#include <vector>
+#include "vectors.h"
+
+// ===================================================================
+// A spatial index over points spread out on the ground plane (x,z),
+// such as tree instances.
+//
+// The points are bucketed into a square grid of 2^n x 2^n cells with a
+// counting sort, with the cells laid out in Morton (Z) order.  That
+// makes the grid an implicit quadtree as well: every quadtree node is
+// a contiguous range of cells, and so of points, and the only extra
+// storage is the height range of each node.  Queries walk the tree
+// from the root and take whole nodes when they are entirely inside.
+//
+// Every point is treated as a sphere of the given radius, so that
+// frustum and range queries find the objects that reach into them.
+
+class SpatialGrid {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  SpatialGrid();
+
+  // =====
+  // BUILD
+  // Index the points.  The counting sort is split between the cores
+  // for large inputs.
+  void build(const std::vector<Vec3f> &points, float radius);
+  int numPoints() const { return positions.size(); }
+
+  // =======
+  // QUERIES
+  // All results are indices into the points given to build.
+  // Points whose sphere touches the box
+  void queryBox(const Vec3f &lo, const Vec3f &hi, std::vector<int> &out) const;
+  // Points whose center is within distance of p
+  void querySphere(const Vec3f &p, float distance, std::vector<int> &out) const;
+  // The k points nearest to p, nearest first
+  void queryNearest(const Vec3f &p, int k, std::vector<int> &out) const;
+  // Points whose sphere is at least partly inside all of the planes,
+  // each ax + by + cz + d >= 0 on the inside
+  void queryFrustum(const float planes[6][4], std::vector<int> &out) const;
+
+  // The planes of the view volume of these matrices (column major, as
+  // returned by glGetFloatv), for queryFrustum
+  static void frustumPlanes(const float modelview[16], const float projection[16], float planes[6][4]);
+
+private:
+
+  // a quadtree node: level 0 is a single cell, level `levels` the root
+  struct Node {
+    Node(int l, int i) : level(l), index(i) {}
+    int level;
+    int index;
+  };
+
+  // helper functions
+  int firstCell(const Node &n) const { return n.index << (2*n.level); }
+  int lastCell(const Node &n) const { return (n.index+1) << (2*n.level); }
+  void nodeBounds(const Node &n, Vec3f &lo, Vec3f &hi) const;
+  void appendNode(const Node &n, std::vector<int> &out) const;
+  static unsigned int morton(unsigned int x, unsigned int z);
+  static unsigned int unmorton(unsigned int m);
+
+  // ==============
+  // REPRESENTATION
+  float radius;
+  Vec3f origin;
+  float cell_size;
+  int side;            // cells along each side, 2^levels
+  int levels;
+  // the points, reordered by cell, and where they came from
+  std::vector<Vec3f> positions;
+  std::vector<int> ids;
+  // the points of cell c are [cell_start[c], cell_start[c+1])
+  std::vector<int> cell_start;
+  // the height range of every node at every level, in Morton order
+  std::vector<std::vector<float> > node_ymin;
+  std::vector<std::vector<float> > node_ymax;
+};
+
+// ===================================================================
+
+#endif
@@ -0,0 +1,149 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "streambuffer.h"
+
+// =======================================================================
+// CONSTRUCTOR & CLEANUP
+// =======================================================================
+
+StreamBuffer::StreamBuffer() :
+  target(GL_ARRAY_BUFFER), buffer(0), size(0), persistent(false),
+  mapped(NULL), current(0), writing(-1) {
+}
+
+// true if the driver can keep a buffer mapped while drawing from it
+static bool bufferStorageSupported() {
+#ifdef GL_ARB_buffer_storage
+  static int supported = -1;
+  if (supported == -1) {
+    const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+    supported = (extensions != NULL && strstr(extensions, "GL_ARB_buffer_storage") != NULL);
+  }
+  return supported == 1;
+#else
+  return false;
+#endif
+}
+
+void StreamBuffer::initialize(GLenum target_, int size_, int regions) {
+  assert (buffer == 0);
+  assert (size_ > 0 && regions >= 1);
+  target = target_;
+  size = size_;
+  current = 0;
+  writing = -1;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+
+  persistent = bufferStorageSupported();
+#ifdef GL_ARB_buffer_storage
+  if (persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(target, (GLsizeiptr)size * regions, NULL, flags);
+    mapped = (unsigned char*)glMapBufferRange(target, 0, (GLsizeiptr)size * regions, flags);
+    if (mapped == NULL) {
+      // start over with a plain buffer; storage can't be resized
+      std::cerr << "Could not map the stream buffer, orphaning it instead\n";
+      glBindBuffer(target, 0);
+      glDeleteBuffers(1, &buffer);
+      glGenBuffers(1, &buffer);
+      glBindBuffer(target, buffer);
+      persistent = false;
+    }
+  }
+#endif
+  if (!persistent) {
+    regions = 1;
+    glBufferData(target, size, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(target, 0);
+
+  versions.assign(regions, -1);
+  fences.assign(regions, (void*)NULL);
+}
+
+void StreamBuffer::cleanup() {
+#ifdef GL_ARB_buffer_storage
+  for (unsigned int i = 0; i < fences.size(); i++) {
+    if (fences[i] != NULL) glDeleteSync((GLsync)fences[i]);
+  }
+#endif
+  fences.clear();
+  versions.clear();
+  if (buffer != 0) {
+    if (mapped != NULL) {
+      glBindBuffer(target, buffer);
+      glUnmapBuffer(target);
+      glBindBuffer(target, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+  }
+  buffer = 0;
+  mapped = NULL;
+}
+
+// =======================================================================
+// WRITING
+// =======================================================================
+
+void* StreamBuffer::beginWrite(int &version) {
+  assert (buffer != 0 && writing == -1);
+
+  if (!persistent) {
+    // a fresh allocation, so nothing of the old contents is left
+    glBindBuffer(target, buffer);
+    glBufferData(target, size, NULL, GL_STREAM_DRAW);
+    void *memory = glMapBuffer(target, GL_WRITE_ONLY);
+    glBindBuffer(target, 0);
+    if (memory == NULL) return NULL;
+    writing = 0;
+    version = -1;
+    return memory;
+  }
+
+#ifdef GL_ARB_buffer_storage
+  // the next region whose draws have finished, oldest first
+  int regions = versions.size();
+  for (int k = 1; k <= regions; k++) {
+    int r = (current + k) % regions;
+    if (fences[r] != NULL) {
+      GLenum status = glClientWaitSync((GLsync)fences[r], 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+      glDeleteSync((GLsync)fences[r]);
+      fences[r] = NULL;
+    }
+    writing = r;
+    version = versions[r];
+    return mapped + r * size;
+  }
+#endif
+  return NULL;
+}
+
+void StreamBuffer::endWrite(int version) {
+  assert (writing >= 0);
+  if (!persistent) {
+    glBindBuffer(target, buffer);
+    if (glUnmapBuffer(target) == GL_FALSE) version = -1;
+    glBindBuffer(target, 0);
+  }
+  versions[writing] = version;
+  current = writing;
+  writing = -1;
+}
+
+// =======================================================================
+// DRAWING
+// =======================================================================
+
+void StreamBuffer::fence() {
+#ifdef GL_ARB_buffer_storage
+  if (!persistent) return;
+  if (fences[current] != NULL) glDeleteSync((GLsync)fences[current]);
+  fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
+}
+
+// =======================================================================
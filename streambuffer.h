@@ -0,0 +1,76 @@
+#ifndef _STREAM_BUFFER_H_
+#define _STREAM_BUFFER_H_
+
+#include <vector>
+#include "glCanvas.h"
+
+// ===================================================================
+// A vertex (or other) buffer that is rewritten while the GPU may still
+// be drawing from its last contents, without waiting for it.
+//
+// Where the driver has GL_ARB_buffer_storage the buffer is a ring of
+// regions (three by default) in one persistently mapped allocation.
+// Each write goes into the next region the GPU is done with, known by
+// the fence placed after the draws that read it, so neither the CPU nor
+// the GPU ever waits on the other.  If every region is still in use the
+// write is refused and the caller tries again later.
+//
+// Without buffer storage, every write orphans the buffer (a new
+// allocation under the same name) and maps the new one, which drivers
+// also turn into a write that never waits.
+//
+// A region keeps what was last written to it, so callers can bring it
+// up to date with only the changes since then: every write is tagged
+// with a version, and beginWrite says which version the region holds.
+
+class StreamBuffer {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & CLEANUP
+  StreamBuffer();
+  // size bytes in each of the regions; needs a GL context
+  void initialize(GLenum target, int size, int regions = 3);
+  void cleanup();
+
+  // =======
+  // WRITING
+  // Pick the next free region and return its memory, with the version
+  // last written there in version (-1 if the contents are undefined).
+  // Returns NULL if the GPU is still reading every region.
+  void* beginWrite(int &version);
+  // Finish the write, tagged with version; later draws use this region
+  void endWrite(int version);
+
+  // =======
+  // DRAWING
+  // The buffer to bind, and the byte offset of the latest region in it
+  GLuint getBuffer() const { return buffer; }
+  int getOffset() const { return current * size; }
+  // Call after the draws that read the latest region
+  void fence();
+
+  bool isPersistent() const { return persistent; }
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  GLenum target;
+  GLuint buffer;
+  int size;
+  bool persistent;
+  unsigned char *mapped;
+  // the region of the latest write, and the one being written
+  int current;
+  int writing;
+  // per region: the version it holds, and the fence (a GLsync, where
+  // there are any) of the last draws that read it, or NULL
+  std::vector<int> versions;
+  std::vector<void*> fences;
+};
+
+// ===================================================================
+
+#endif
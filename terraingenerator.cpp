@@ -8,14 +8,18 @@
 
 #include "terraingenerator.h"
 
-#include "utils.h"
+#include "counterrng.h"
+#include "jobsystem.h"
 
 #include <cmath>
 
 float TerrainGenerator::ratio = 1.0f;
 float TerrainGenerator::scale = 1.0f;
 
-float TerrainGenerator::getRandomOffset(int depth)
+//  Offsets first to first+count-1 of one diamond or square step.  Each
+//  is a sign and a size drawn by its index from GLOBAL_rng, so every
+//  piece of a step gets the same offsets however the rows are split.
+void TerrainGenerator::getRandomOffsets(int depth, int step, int first, int count, float *out)
 {
   float scaleDown = 1;
 
@@ -23,8 +27,16 @@ float TerrainGenerator::getRandomOffset(int depth)
   {
     scaleDown *= pow(2,-ratio);
   }
-  if (GLOBAL_mtrand.rand() > 0.5) scaleDown = -scaleDown;
-  return GLOBAL_mtrand.rand()*scale*scaleDown;
+
+  ScratchArena &scratch = GLOBAL_jobs.scratch();
+  ScratchScope scope (scratch);
+  float *draws = scratch.allocate<float>(2 * count);
+  GLOBAL_rng.fillExc(RNG_TERRAIN, step, 2 * first, draws, 2 * count);
+  for (int i = 0; i < count; ++i)
+  {
+    float sign = (draws[2*i] > 0.5f) ? -1 : 1;
+    out[i] = draws[2*i+1]*scale*scaleDown*sign;
+  }
 }
 
 void TerrainGenerator::diamondIteration(std::vector<std::vector<float> >& vec, int count)
@@ -34,23 +46,29 @@ void TerrainGenerator::diamondIteration(std::vector<std::vector<float> >& vec, i
   int numSegments = pow(2, count-1);
   int span = sideLengthZero / numSegments;
   int halfSpan = span / 2;
-  int x1, x2, y1, y2;
-  float avg;
 
-  for (int x = 0; x < sideLengthZero; x += span)
+  //  Every square sets its own center, so the rows can go in parallel
+  GLOBAL_jobs.parallelFor(0, numSegments, 8, [&](int lo, int hi)
   {
-    for (int y = 0; y < sideLengthZero; y += span)
+    int x1, x2, y1, y2;
+    float avg;
+    std::vector<float> offsets ((hi - lo) * numSegments);
+    getRandomOffsets(count, 2 * count, lo * numSegments, offsets.size(), &offsets[0]);
+    for (int sx = lo; sx < hi; ++sx)
     {
-      x1 = x;
-      x2 = x+span;
-      y1 = y;
-      y2 = y+span;
-
-      avg = vec[x1][y1] + vec[x2][y1] + vec[x2][y2] + vec[x1][y2];
-      avg *= 0.25f;
-      vec[x1+halfSpan][y1+halfSpan] = avg + getRandomOffset(count);
+      for (int sy = 0; sy < numSegments; ++sy)
+      {
+        x1 = sx * span;
+        x2 = x1 + span;
+        y1 = sy * span;
+        y2 = y1 + span;
+
+        avg = vec[x1][y1] + vec[x2][y1] + vec[x2][y2] + vec[x1][y2];
+        avg *= 0.25f;
+        vec[x1+halfSpan][y1+halfSpan] = avg + offsets[(sx - lo) * numSegments + sy];
+      }
     }
-  }
+  });
 }
 
 void TerrainGenerator::squareIteration(std::vector<std::vector<float> >& vec, int count)
@@ -60,47 +78,75 @@ void TerrainGenerator::squareIteration(std::vector<std::vector<float> >& vec, in
   int numSegments = pow(2, count-1);
   int span = sideLengthZero / numSegments;
   int halfSpan = span / 2;
-  int x1, x2, y1, y2, xHalf, yHalf, rr, dd, ll, uu;
-  float avg;
 
-  for (int x = 0; x < sideLengthZero; x += span)
+  //  The edge midpoints only depend on the corners and centers, which
+  //  this pass doesn't change, so they can all be found in parallel.
+  //  Neighboring squares share edges, so they are stored afterwards in
+  //  the serial order, where the later square wins.
+  std::vector<float> mids (numSegments * numSegments * 4);
+  GLOBAL_jobs.parallelFor(0, numSegments, 8, [&](int lo, int hi)
   {
-    for (int y = 0; y < sideLengthZero; y += span)
+    int x1, x2, y1, y2, xHalf, yHalf, rr, dd, ll, uu;
+    float avg;
+    std::vector<float> offsets ((hi - lo) * numSegments * 4);
+    getRandomOffsets(count, 2 * count + 1, lo * numSegments * 4, offsets.size(), &offsets[0]);
+    for (int sx = lo; sx < hi; ++sx)
     {
-      x1 = x;
-      x2 = x+span;
-      y1 = y;
-      y2 = y+span;
-      xHalf = x+halfSpan;
-      yHalf = y+halfSpan;
-
-      rr = x + span + halfSpan;
-      if (rr > sideLengthZero) rr = halfSpan;
-
-      dd = y + span + halfSpan;
-      if (dd > sideLengthZero) dd = halfSpan;
-
-      ll = x - halfSpan;
-      if (ll < 0) ll = sideLengthZero - halfSpan;
-
-      uu = y - halfSpan;
-      if (uu < 0) uu = sideLengthZero - halfSpan;
-
-      avg = vec[x1][y1] + vec[xHalf][yHalf] + vec[x1][y2] + vec[ll][yHalf];
-      avg *= 0.25f;
-      vec[x1][yHalf] = avg + getRandomOffset(count);
-
-      avg = vec[x1][y1] + vec[xHalf][uu] + vec[x2][y1] + vec[xHalf][yHalf];
-      avg *= 0.25f;
-      vec[xHalf][y1] = avg + getRandomOffset(count);
-
-      avg = vec[x2][y1] + vec[rr][yHalf] + vec[x2][y2] + vec[xHalf][yHalf];
-      avg *= 0.25f;
-      vec[x2][yHalf] = avg + getRandomOffset(count);
+      for (int sy = 0; sy < numSegments; ++sy)
+      {
+        int x = sx * span;
+        int y = sy * span;
+        float *out = &mids[(sx * numSegments + sy) * 4];
+        const float *offset = &offsets[((sx - lo) * numSegments + sy) * 4];
+        x1 = x;
+        x2 = x+span;
+        y1 = y;
+        y2 = y+span;
+        xHalf = x+halfSpan;
+        yHalf = y+halfSpan;
+
+        rr = x + span + halfSpan;
+        if (rr > sideLengthZero) rr = halfSpan;
+
+        dd = y + span + halfSpan;
+        if (dd > sideLengthZero) dd = halfSpan;
+
+        ll = x - halfSpan;
+        if (ll < 0) ll = sideLengthZero - halfSpan;
+
+        uu = y - halfSpan;
+        if (uu < 0) uu = sideLengthZero - halfSpan;
+
+        avg = vec[x1][y1] + vec[xHalf][yHalf] + vec[x1][y2] + vec[ll][yHalf];
+        avg *= 0.25f;
+        out[0] = avg + offset[0];
+
+        avg = vec[x1][y1] + vec[xHalf][uu] + vec[x2][y1] + vec[xHalf][yHalf];
+        avg *= 0.25f;
+        out[1] = avg + offset[1];
+
+        avg = vec[x2][y1] + vec[rr][yHalf] + vec[x2][y2] + vec[xHalf][yHalf];
+        avg *= 0.25f;
+        out[2] = avg + offset[2];
+
+        avg = vec[x1][y2] + vec[xHalf][yHalf] + vec[x2][y2] + vec[xHalf][dd];
+        avg *= 0.25f;
+        out[3] = avg + offset[3];
+      }
+    }
+  });
 
-      avg = vec[x1][y2] + vec[xHalf][yHalf] + vec[x2][y2] + vec[xHalf][dd];
-      avg *= 0.25f;
-      vec[xHalf][y2] = avg + getRandomOffset(count);
+  for (int sx = 0; sx < numSegments; ++sx)
+  {
+    for (int sy = 0; sy < numSegments; ++sy)
+    {
+      int x = sx * span;
+      int y = sy * span;
+      const float *mid = &mids[(sx * numSegments + sy) * 4];
+      vec[x][y+halfSpan] = mid[0];
+      vec[x+halfSpan][y] = mid[1];
+      vec[x+span][y+halfSpan] = mid[2];
+      vec[x+halfSpan][y+span] = mid[3];
     }
   }
   
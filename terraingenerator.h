@@ -15,13 +15,15 @@
 class TerrainGenerator {
   static float ratio;
   static float scale;
-  static float getRandomOffset(int);
+  static void getRandomOffsets(int, int, int, int, float*);
   static void diamondIteration(std::vector<std::vector<float> >&, int);
   static void squareIteration(std::vector<std::vector<float> >&, int);
 
 public:
   static void setRatio(float newRatio) { ratio = newRatio; };
   static void setScale(float newScale) { scale = newScale; };
+  static float getRatio() { return ratio; };
+  static float getScale() { return scale; };
   static std::vector<std::vector<float> > generate(int squaresPerSide);
   
 };
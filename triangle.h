@@ -1,6 +1,7 @@
 #ifndef _TRIANGLE_H
 #define _TRIANGLE_H
 
+#include <atomic>
 #include "edge.h"
 
 class Hit;
@@ -20,8 +21,7 @@ public:
   // CONSTRUCTOR & DESTRUCTOR
   Triangle() {
     edge = NULL; 
-    id = next_triangle_id;
-    next_triangle_id++;
+    id = next_triangle_id++;
   }
 
   // =========
@@ -88,8 +88,9 @@ protected:
   //s,t[2] are texture coordinates at edge->getNext()->getNext()->getStartVertex()
   double s[3],t[3];
   
-  // triangles are indexed starting at 0
-  static int next_triangle_id;
+  // triangles are indexed starting at 0 (several meshes may be loading
+  // at once, so the counter is atomic)
+  static std::atomic<int> next_triangle_id;
 
   //The material of this triangle
   Material *material;
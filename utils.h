@@ -2,7 +2,7 @@
 #define _UTILS_H
 
 #include "vectors.h"
-#include "MersenneTwister.h"
+#include "counterrng.h"
 
 #define square(x) ((x)*(x))
 
@@ -16,8 +16,7 @@
 #endif
 
 
-// a single random number generate for reproduceable randomness
-extern MTRand GLOBAL_mtrand;
+// reproduceable randomness comes from GLOBAL_rng (counterrng.h)
 
 // =========================================================================
 // EPSILON is a necessary evil for raytracing implementations
@@ -78,12 +77,12 @@ inline double AreaOfTriangle(const Vec3f &a, const Vec3f &b, const Vec3f &c) {
 }
 
 // utility function to generate random numbers used for sampling
-inline Vec3f RandomUnitVector() {
+inline Vec3f RandomUnitVector(RandomStream &rng) {
   Vec3f tmp;
   while (true) {
-    tmp = Vec3f(2*GLOBAL_mtrand.rand()-1,  // random real in [-1,1]
-		2*GLOBAL_mtrand.rand()-1,  // random real in [-1,1]
-		2*GLOBAL_mtrand.rand()-1); // random real in [-1,1]
+    tmp = Vec3f(2*rng.rand()-1,  // random real in [-1,1]
+		2*rng.rand()-1,  // random real in [-1,1]
+		2*rng.rand()-1); // random real in [-1,1]
     if (tmp.Length() < 1) break;
   }
   tmp.Normalize();
@@ -99,8 +98,8 @@ inline Vec3f MirrorDirection(const Vec3f &normal, const Vec3f &incoming) {
 
 // compute a random diffuse direction
 // (not the same as a uniform random direction on the hemisphere)
-inline Vec3f RandomDiffuseDirection(const Vec3f &normal) {
-  Vec3f answer = normal+RandomUnitVector();
+inline Vec3f RandomDiffuseDirection(const Vec3f &normal, RandomStream &rng) {
+  Vec3f answer = normal+RandomUnitVector(rng);
   answer.Normalize();
   return answer;
 }
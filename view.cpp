@@ -7,20 +7,22 @@
 */
 
 #include "view.h"
+#include "impostoratlas.h"
 #include <cfloat>
+#include <vector>
 
 //TEST
 #include <iostream>
 
 //Default constructor
 View::View() :
-  mesh(NULL)
+  atlas(NULL), cell(-1), mesh(NULL)
 {
 }
 
 //Another constructor
-View::View(Mesh* inmesh) :
-  mesh(inmesh)
+View::View(Mesh* inmesh, ImpostorAtlas* inatlas) :
+  atlas(inatlas), cell(-1), mesh(inmesh)
 {
 }
 
@@ -79,8 +81,9 @@ void View::computeView(float angXZ, float angY, int distance, Vec3f min, Vec3f m
   camera.glPlaceCamera();
 
   //Set the viewport for these renders
-  int oldWidth = glutGet(GLUT_WINDOW_WIDTH);
-  int oldHeight = glutGet(GLUT_WINDOW_HEIGHT);
+  //The old one is asked of GL, not GLUT, since there may be no window
+  GLint oldViewport[4];
+  glGetIntegerv(GL_VIEWPORT, oldViewport);
   glViewport(0,0,VIEW_SIZE,VIEW_SIZE);
 
   //Set up OpenGL states
@@ -92,7 +95,8 @@ void View::computeView(float angXZ, float angY, int distance, Vec3f min, Vec3f m
 
   HandleGLError("Before FBO");
 
-  //Create the color FBO and depth RB
+  //Create the color FBO and depth RB, and a texture to render to
+  GLuint texture;
   GLuint color_FBO;
   GLuint depth_RB;
   glGenTextures(1, &texture);
@@ -172,8 +176,16 @@ void View::computeView(float angXZ, float angY, int distance, Vec3f min, Vec3f m
   glDeleteFramebuffers(1, &color_FBO);
   glDeleteRenderbuffers(1, &depth_RB);
 
+  //The render is only needed to read the colors back, which go into
+  //the atlas with the rest of the views
+  glDeleteTextures(1, &texture);
+  assert(atlas != NULL);
+  cell = atlas->allocateCell();
+  assert(cell >= 0);
+  atlas->store(cell, texdata);
+
   //Reset viewport
-  glViewport(0,0,oldWidth,oldHeight);
+  glViewport(oldViewport[0],oldViewport[1],oldViewport[2],oldViewport[3]);
 
   HandleGLError("Leaving computeView");
 }
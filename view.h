@@ -17,6 +17,8 @@ const int VIEW_SIZE = 256;
 #include "camera.h"
 #include "hit.h"
 
+class ImpostorAtlas;
+
 //Struct for each texel
 struct texel
 {
@@ -39,12 +41,13 @@ class View
  public:
   //Constructors
   View();
-  View(Mesh* inmesh);
+  View(Mesh* inmesh, ImpostorAtlas* inatlas);
 
   //Accessors
   texel getTexel(int i, int j) {return data[(VIEW_SIZE*i)+j];}
   Vec3f color(int i, int j) {return data[(VIEW_SIZE*i)+j].color;}
-  GLuint textureID() {return texture;}
+  //The cell of the atlas the view is kept in, -1 until it is computed
+  int getCell() {return cell;}
 
   //General use functions
   void computeView(float angXZ, float angY, int distance);
@@ -54,8 +57,9 @@ class View
   //The array of additional information
   texel data[VIEW_SIZE*VIEW_SIZE];
 
-  //The texture generated from this view
-  GLuint texture;
+  //The atlas the render goes into, and where in it
+  ImpostorAtlas* atlas;
+  int cell;
 
   //The point where the tree rests on the ground
   int basex;
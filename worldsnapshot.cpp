@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "worldsnapshot.h"
+
+static const char SNAPSHOT_MAGIC[4] = { 'T', 'W', 'L', 'D' };
+static const int SNAPSHOT_VERSION = 1;
+
+// the start of the file; the arrays follow in this order:
+//   float heights[height_samples^2]     row by row
+//   int   tree_counts[num_blocks]
+//   float tree_xz[num_trees][2]         block space
+//   int   views[num_trees][2]           level, point
+struct SnapshotHeader {
+  char magic[4];
+  int version;
+  unsigned int seed;
+  float terrain_ratio;
+  float terrain_scale;
+  int distribution;
+  float tree_spacing;
+  int ecology;
+  float water_level;
+  float tree_line;
+  float max_slope;
+  int num_blocks;
+  float area;
+  int height_samples;
+  int num_trees;
+};
+
+// =======================================================================
+// CONSTRUCTOR
+// =======================================================================
+
+WorldSnapshot::WorldSnapshot() {
+  seed = 0;
+  terrain_ratio = 1;
+  terrain_scale = 1;
+  distribution = "poisson";
+  tree_spacing = 0;
+  ecology = false;
+  water_level = 0;
+  tree_line = 0;
+  max_slope = 0;
+  num_blocks = 0;
+  area = 0;
+}
+
+// =======================================================================
+// LOADING
+// =======================================================================
+
+// copy count items out of the file, failing if they run past the end
+template <class T>
+static bool readArray(const char *&p, const char *end, T *out, size_t count) {
+  size_t bytes = count * sizeof(T);
+  if ((size_t)(end - p) < bytes) return false;
+  if (bytes > 0) memcpy(out, p, bytes);
+  p += bytes;
+  return true;
+}
+
+static bool parseSnapshot(const char *data, size_t size, WorldSnapshot &world) {
+  const char *p = data, *end = data + size;
+  SnapshotHeader header;
+  if (!readArray(p, end, &header, 1)) return false;
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0 || header.version != SNAPSHOT_VERSION) return false;
+  if (header.height_samples < 2 || header.num_blocks < 1 || header.num_trees < 0) return false;
+  // nothing bigger than the file itself, before anything is allocated
+  if ((double)header.height_samples * header.height_samples * sizeof(float) > size ||
+      (double)header.num_blocks * sizeof(int) > size ||
+      (double)header.num_trees * 4 * sizeof(int) > size) return false;
+
+  world.seed = header.seed;
+  world.terrain_ratio = header.terrain_ratio;
+  world.terrain_scale = header.terrain_scale;
+  world.distribution = header.distribution ? "poisson" : "lattice";
+  world.tree_spacing = header.tree_spacing;
+  world.ecology = header.ecology != 0;
+  world.water_level = header.water_level;
+  world.tree_line = header.tree_line;
+  world.max_slope = header.max_slope;
+  world.num_blocks = header.num_blocks;
+  world.area = header.area;
+
+  int n = header.height_samples;
+  world.heights.assign(n, std::vector<float>(n));
+  for (int i = 0; i < n; i++) {
+    if (!readArray(p, end, world.heights[i].data(), n)) return false;
+  }
+
+  std::vector<int> counts(header.num_blocks);
+  if (!readArray(p, end, counts.data(), counts.size())) return false;
+  std::vector<float> xz(2*header.num_trees);
+  std::vector<int> views(2*header.num_trees);
+  if (!readArray(p, end, xz.data(), xz.size())) return false;
+  if (!readArray(p, end, views.data(), views.size())) return false;
+
+  world.trees.assign(header.num_blocks, std::vector<Vec3f>());
+  world.view_level.resize(header.num_trees);
+  world.view_point.resize(header.num_trees);
+  int t = 0;
+  for (int b = 0; b < header.num_blocks; b++) {
+    if (counts[b] < 0 || t + counts[b] > header.num_trees) return false;
+    world.trees[b].reserve(counts[b]);
+    for (int k = 0; k < counts[b]; k++, t++) {
+      world.trees[b].push_back(Vec3f(xz[2*t], 0, xz[2*t+1]));
+      world.view_level[t] = views[2*t];
+      world.view_point[t] = views[2*t+1];
+    }
+  }
+  return t == header.num_trees;
+}
+
+bool WorldSnapshot::load(const std::string &filename) {
+  bool ok = false;
+#ifdef _WIN32
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file != NULL) {
+    std::vector<char> data;
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      data.insert(data.end(), buffer, buffer + count);
+    }
+    fclose(file);
+    ok = !data.empty() && parseSnapshot(&data[0], data.size(), *this);
+  }
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        ok = parseSnapshot((const char*)map, info.st_size, *this);
+        munmap(map, info.st_size);
+      }
+    }
+    close(fd);
+  }
+#endif
+  if (!ok) {
+    std::cerr << "Could not load the world snapshot " << filename << "\n";
+  }
+  return ok;
+}
+
+// =======================================================================
+// SAVING
+// =======================================================================
+
+bool WorldSnapshot::save(const std::string &filename) const {
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+  header.version = SNAPSHOT_VERSION;
+  header.seed = seed;
+  header.terrain_ratio = terrain_ratio;
+  header.terrain_scale = terrain_scale;
+  header.distribution = (distribution == "poisson") ? 1 : 0;
+  header.tree_spacing = tree_spacing;
+  header.ecology = ecology ? 1 : 0;
+  header.water_level = water_level;
+  header.tree_line = tree_line;
+  header.max_slope = max_slope;
+  header.num_blocks = num_blocks;
+  header.area = area;
+  header.height_samples = heights.size();
+
+  // flatten everything first so the file goes out in a few large writes
+  std::vector<float> flat_heights;
+  for (unsigned int i = 0; i < heights.size(); i++) {
+    flat_heights.insert(flat_heights.end(), heights[i].begin(), heights[i].end());
+  }
+  std::vector<int> counts;
+  std::vector<float> xz;
+  for (unsigned int b = 0; b < trees.size(); b++) {
+    counts.push_back(trees[b].size());
+    for (unsigned int k = 0; k < trees[b].size(); k++) {
+      xz.push_back(trees[b][k].x());
+      xz.push_back(trees[b][k].z());
+    }
+  }
+  header.num_trees = xz.size() / 2;
+  std::vector<int> views(2*header.num_trees, -1);
+  for (int t = 0; t < header.num_trees && t < (int)view_level.size() && t < (int)view_point.size(); t++) {
+    views[2*t] = view_level[t];
+    views[2*t+1] = view_point[t];
+  }
+
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == NULL) {
+    std::cerr << "Could not write the world snapshot " << filename << "\n";
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, file);
+  if (!flat_heights.empty()) fwrite(&flat_heights[0], sizeof(float), flat_heights.size(), file);
+  if (!counts.empty()) fwrite(&counts[0], sizeof(int), counts.size(), file);
+  if (!xz.empty()) fwrite(&xz[0], sizeof(float), xz.size(), file);
+  if (!views.empty()) fwrite(&views[0], sizeof(int), views.size(), file);
+  bool ok = !ferror(file);
+  fclose(file);
+  if (!ok) {
+    std::cerr << "Could not write the world snapshot " << filename << "\n";
+  }
+  return ok;
+}
+
+// =======================================================================
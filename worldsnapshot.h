@@ -0,0 +1,64 @@
+#ifndef _WORLD_SNAPSHOT_H_
+#define _WORLD_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+#include "vectors.h"
+
+// ===================================================================
+// Everything needed to bring back a generated world without running
+// the generators again: the terrain heights, the trees, the impostor
+// view each tree was showing, and the seed and generator settings the
+// world came from.
+//
+// The file is a fixed header followed by flat arrays, so loading is a
+// memory map, a few size checks and straight copies out of the map.
+// The data is written in the machine's own byte order; a file from a
+// machine with another word layout fails the header check.
+
+class WorldSnapshot {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  WorldSnapshot();
+
+  // ===========
+  // FILE ACCESS
+  // false (and a message) if the file is missing or malformed
+  bool load(const std::string &filename);
+  bool save(const std::string &filename) const;
+
+  // ==============
+  // REPRESENTATION
+  // where the world came from
+  unsigned int seed;
+  float terrain_ratio;
+  float terrain_scale;
+  std::string distribution;
+  float tree_spacing;
+  bool ecology;
+  float water_level;
+  float tree_line;
+  float max_slope;
+
+  // the layout of the ground, which has to match the forest's
+  int num_blocks;
+  float area;
+
+  // (n+1)x(n+1) terrain heights, as from TerrainGenerator::generate
+  std::vector<std::vector<float> > heights;
+
+  // the trees of every block, in block space (y is always 0)
+  std::vector<std::vector<Vec3f> > trees;
+
+  // for every tree, in block order, the hemisphere level and point of
+  // the view it was drawn with, or -1 if it had none
+  std::vector<int> view_level;
+  std::vector<int> view_point;
+};
+
+// ===================================================================
+
+#endif